@@ -0,0 +1,594 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __GNUC__
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#endif
+
+// B+ tree.
+// A cache friendly alternative to rb_tree. The keys are extracted from the
+// values once, at the insert, and kept inline in sorted arrays, so that a
+// lookup touches a few cache lines for each level instead of one node per
+// compare. The values are not owned by the tree. Leaves are linked for range
+// scans.
+
+// The max number of keys of a node, the keys of a node fill 2 cache lines.
+#define B_PLUS_TREE_ORDER 16
+#define B_PLUS_TREE_MIN_KEYS (B_PLUS_TREE_ORDER / 2)
+
+typedef int64_t b_plus_key;
+
+typedef struct b_plus_node b_plus_node;
+
+struct b_plus_node {
+  b_plus_key keys[B_PLUS_TREE_ORDER];
+  uint32_t size;
+  bool is_leaf;
+  union {
+    // Internal node: child[i] holds the keys in [keys[i - 1], keys[i]).
+    b_plus_node *child[B_PLUS_TREE_ORDER + 1];
+    struct {
+      void *value[B_PLUS_TREE_ORDER];
+      b_plus_node *next;
+    } leaf;
+  };
+};
+
+typedef struct b_plus_tree {
+  b_plus_node *root;
+  size_t size;
+  b_plus_key (*key_of)(const void *value);
+} b_plus_tree;
+
+// key_of extracts the key from a value, it may be NULL if only the
+// b_plus_tree_insert_key interface is used.
+int init_b_plus_tree(b_plus_tree *tree, b_plus_key (*key_of)(const void *)) {
+  tree->root = NULL, tree->size = 0, tree->key_of = key_of;
+  return 0;
+}
+
+static b_plus_node *_make_b_plus_node(bool is_leaf) {
+  b_plus_node *node = (b_plus_node *)malloc(sizeof(b_plus_node));
+#ifdef __GNUC__
+  if (unlikely(!node)) {
+#else
+  if (!node) {
+#endif
+    return NULL;
+  }
+  node->size = 0;
+  node->is_leaf = is_leaf;
+  if (is_leaf) {
+    node->leaf.next = NULL;
+  }
+  return node;
+}
+
+// The number of keys less than key. The loop has no early exit, so it is
+// compiled into a branchless (and vectorized) scan of the key array.
+static inline uint32_t _b_plus_lower_bound(const b_plus_node *node,
+                                           b_plus_key key) {
+  uint32_t pos = 0;
+  for (uint32_t i = 0; i < node->size; i++) {
+    pos += node->keys[i] < key;
+  }
+  return pos;
+}
+
+// The number of keys less than or equal to key, which is also the index of
+// the child to descend into.
+static inline uint32_t _b_plus_upper_bound(const b_plus_node *node,
+                                           b_plus_key key) {
+  uint32_t pos = 0;
+  for (uint32_t i = 0; i < node->size; i++) {
+    pos += node->keys[i] <= key;
+  }
+  return pos;
+}
+
+void *b_plus_tree_find(b_plus_tree *tree, b_plus_key key) {
+  b_plus_node *node = tree->root;
+  if (node == NULL) {
+    return NULL;
+  }
+  while (!node->is_leaf) {
+    node = node->child[_b_plus_upper_bound(node, key)];
+  }
+  uint32_t pos = _b_plus_lower_bound(node, key);
+  if (pos < node->size && node->keys[pos] == key) {
+    return node->leaf.value[pos];
+  }
+  return NULL;
+}
+
+// Returned by the recursive insert when the node is split, the new node is on
+// the right and sep is the first key below it.
+struct _b_plus_split {
+  b_plus_node *right;
+  b_plus_key sep;
+};
+
+// No node has less than B_PLUS_TREE_MIN_KEYS + 1 children except the root,
+// so a tree of 2^64 keys is far lower than this.
+#define B_PLUS_TREE_MAX_HEIGHT 32
+
+// The nodes allocated before an insert descends: one for each full node on
+// the path that is going to split, and one more for the new root if the root
+// splits too. Once the descent starts, it can not fail any more.
+struct _b_plus_spare {
+  b_plus_node *node[B_PLUS_TREE_MAX_HEIGHT + 1];
+  uint32_t size;
+};
+
+static inline b_plus_node *_b_plus_take_spare(struct _b_plus_spare *spare,
+                                              bool is_leaf) {
+  assert(spare->size > 0);
+  b_plus_node *node = spare->node[--spare->size];
+  node->is_leaf = is_leaf;
+  if (is_leaf) {
+    node->leaf.next = NULL;
+  }
+  return node;
+}
+
+// Fill the spare nodes for inserting key. 0 for success, -1 for duplicate
+// key, -2 for allocation failure, in which case nothing is kept.
+static int _b_plus_prepare_insert(b_plus_node *node, b_plus_key key,
+                                  struct _b_plus_spare *spare) {
+  // The nodes that split are the full ones at the bottom of the path.
+  uint32_t height = 0, full = 0;
+  while (!node->is_leaf) {
+    height++;
+    full = node->size == B_PLUS_TREE_ORDER ? full + 1 : 0;
+    node = node->child[_b_plus_upper_bound(node, key)];
+  }
+  uint32_t pos = _b_plus_lower_bound(node, key);
+  if (pos < node->size && node->keys[pos] == key) {
+    return -1;
+  }
+  height++;
+  full = node->size == B_PLUS_TREE_ORDER ? full + 1 : 0;
+  assert(height <= B_PLUS_TREE_MAX_HEIGHT);
+
+  uint32_t needed = full == height ? full + 1 : full;
+  for (spare->size = 0; spare->size < needed; spare->size++) {
+    spare->node[spare->size] = _make_b_plus_node(false);
+#ifdef __GNUC__
+    if (unlikely(spare->node[spare->size] == NULL)) {
+#else
+    if (spare->node[spare->size] == NULL) {
+#endif
+      while (spare->size > 0) {
+        free(spare->node[--spare->size]);
+      }
+      return -2;
+    }
+  }
+  return 0;
+}
+
+// The key must not exist, and the spare nodes must be prepared by
+// _b_plus_prepare_insert, so this never fails.
+static void _b_plus_insert(b_plus_node *node, b_plus_key key, void *value,
+                           struct _b_plus_spare *spare,
+                           struct _b_plus_split *split) {
+  split->right = NULL;
+  if (node->is_leaf) {
+    uint32_t pos = _b_plus_lower_bound(node, key);
+    assert(pos == node->size || node->keys[pos] != key);
+    if (node->size < B_PLUS_TREE_ORDER) {
+      memmove(node->keys + pos + 1, node->keys + pos,
+              (node->size - pos) * sizeof(b_plus_key));
+      memmove(node->leaf.value + pos + 1, node->leaf.value + pos,
+              (node->size - pos) * sizeof(void *));
+      node->keys[pos] = key;
+      node->leaf.value[pos] = value;
+      node->size++;
+      return;
+    }
+
+    b_plus_node *right = _b_plus_take_spare(spare, true);
+    b_plus_key keys[B_PLUS_TREE_ORDER + 1];
+    void *values[B_PLUS_TREE_ORDER + 1];
+    memcpy(keys, node->keys, pos * sizeof(b_plus_key));
+    memcpy(values, node->leaf.value, pos * sizeof(void *));
+    keys[pos] = key, values[pos] = value;
+    memcpy(keys + pos + 1, node->keys + pos,
+           (B_PLUS_TREE_ORDER - pos) * sizeof(b_plus_key));
+    memcpy(values + pos + 1, node->leaf.value + pos,
+           (B_PLUS_TREE_ORDER - pos) * sizeof(void *));
+
+    uint32_t left_size = (B_PLUS_TREE_ORDER + 1) / 2;
+    uint32_t right_size = B_PLUS_TREE_ORDER + 1 - left_size;
+    memcpy(node->keys, keys, left_size * sizeof(b_plus_key));
+    memcpy(node->leaf.value, values, left_size * sizeof(void *));
+    memcpy(right->keys, keys + left_size, right_size * sizeof(b_plus_key));
+    memcpy(right->leaf.value, values + left_size,
+           right_size * sizeof(void *));
+    node->size = left_size, right->size = right_size;
+    right->leaf.next = node->leaf.next;
+    node->leaf.next = right;
+
+    split->right = right;
+    split->sep = right->keys[0];
+    return;
+  }
+
+  uint32_t pos = _b_plus_upper_bound(node, key);
+  struct _b_plus_split child_split;
+  _b_plus_insert(node->child[pos], key, value, spare, &child_split);
+  if (child_split.right == NULL) {
+    return;
+  }
+
+  if (node->size < B_PLUS_TREE_ORDER) {
+    memmove(node->keys + pos + 1, node->keys + pos,
+            (node->size - pos) * sizeof(b_plus_key));
+    memmove(node->child + pos + 2, node->child + pos + 1,
+            (node->size - pos) * sizeof(b_plus_node *));
+    node->keys[pos] = child_split.sep;
+    node->child[pos + 1] = child_split.right;
+    node->size++;
+    return;
+  }
+
+  b_plus_node *right = _b_plus_take_spare(spare, false);
+  b_plus_key keys[B_PLUS_TREE_ORDER + 1];
+  b_plus_node *children[B_PLUS_TREE_ORDER + 2];
+  memcpy(keys, node->keys, pos * sizeof(b_plus_key));
+  keys[pos] = child_split.sep;
+  memcpy(keys + pos + 1, node->keys + pos,
+         (B_PLUS_TREE_ORDER - pos) * sizeof(b_plus_key));
+  memcpy(children, node->child, (pos + 1) * sizeof(b_plus_node *));
+  children[pos + 1] = child_split.right;
+  memcpy(children + pos + 2, node->child + pos + 1,
+         (B_PLUS_TREE_ORDER - pos) * sizeof(b_plus_node *));
+
+  // The middle key moves up to the parent.
+  uint32_t left_size = (B_PLUS_TREE_ORDER + 1) / 2;
+  uint32_t right_size = B_PLUS_TREE_ORDER - left_size;
+  memcpy(node->keys, keys, left_size * sizeof(b_plus_key));
+  memcpy(node->child, children, (left_size + 1) * sizeof(b_plus_node *));
+  memcpy(right->keys, keys + left_size + 1, right_size * sizeof(b_plus_key));
+  memcpy(right->child, children + left_size + 1,
+         (right_size + 1) * sizeof(b_plus_node *));
+  node->size = left_size, right->size = right_size;
+
+  split->right = right;
+  split->sep = keys[left_size];
+}
+
+// 0 for success, -1 if the key exists or the value is NULL, -2 if the memory
+// is used up, in which case the tree is left unchanged. NULL is reserved by
+// b_plus_tree_find and b_plus_tree_remove for a missing key, so it can not be
+// a value.
+int b_plus_tree_insert_key(b_plus_tree *tree, b_plus_key key, void *value) {
+  if (value == NULL) {
+    return -1;
+  }
+  if (tree->root == NULL) {
+    tree->root = _make_b_plus_node(true);
+    if (tree->root == NULL) {
+      return -2;
+    }
+  }
+
+  struct _b_plus_spare spare;
+  int res = _b_plus_prepare_insert(tree->root, key, &spare);
+  if (res) {
+    if (tree->size == 0) {
+      free(tree->root);
+      tree->root = NULL;
+    }
+    return res;
+  }
+  struct _b_plus_split split;
+  _b_plus_insert(tree->root, key, value, &spare, &split);
+  if (split.right) {
+    b_plus_node *new_root = _b_plus_take_spare(&spare, false);
+    new_root->keys[0] = split.sep;
+    new_root->child[0] = tree->root;
+    new_root->child[1] = split.right;
+    new_root->size = 1;
+    tree->root = new_root;
+  }
+  assert(spare.size == 0);
+  tree->size++;
+  return 0;
+}
+
+int b_plus_tree_insert(b_plus_tree *tree, void *value) {
+  assert(tree->key_of);
+  return b_plus_tree_insert_key(tree, tree->key_of(value), value);
+}
+
+// Fix child pos of node after it loses a key, by borrowing a key from a
+// sibling or merging with it.
+static void _b_plus_fix_child(b_plus_node *node, uint32_t pos) {
+  b_plus_node *child = node->child[pos];
+  b_plus_node *left = pos > 0 ? node->child[pos - 1] : NULL;
+  b_plus_node *right = pos < node->size ? node->child[pos + 1] : NULL;
+
+  if (left && left->size > B_PLUS_TREE_MIN_KEYS) {
+    memmove(child->keys + 1, child->keys, child->size * sizeof(b_plus_key));
+    if (child->is_leaf) {
+      memmove(child->leaf.value + 1, child->leaf.value,
+              child->size * sizeof(void *));
+      child->keys[0] = left->keys[left->size - 1];
+      child->leaf.value[0] = left->leaf.value[left->size - 1];
+      node->keys[pos - 1] = child->keys[0];
+    } else {
+      memmove(child->child + 1, child->child,
+              (child->size + 1) * sizeof(b_plus_node *));
+      child->keys[0] = node->keys[pos - 1];
+      child->child[0] = left->child[left->size];
+      node->keys[pos - 1] = left->keys[left->size - 1];
+    }
+    child->size++, left->size--;
+    return;
+  }
+
+  if (right && right->size > B_PLUS_TREE_MIN_KEYS) {
+    if (child->is_leaf) {
+      child->keys[child->size] = right->keys[0];
+      child->leaf.value[child->size] = right->leaf.value[0];
+      memmove(right->leaf.value, right->leaf.value + 1,
+              (right->size - 1) * sizeof(void *));
+      memmove(right->keys, right->keys + 1,
+              (right->size - 1) * sizeof(b_plus_key));
+      node->keys[pos] = right->keys[0];
+    } else {
+      child->keys[child->size] = node->keys[pos];
+      child->child[child->size + 1] = right->child[0];
+      node->keys[pos] = right->keys[0];
+      memmove(right->keys, right->keys + 1,
+              (right->size - 1) * sizeof(b_plus_key));
+      memmove(right->child, right->child + 1,
+              right->size * sizeof(b_plus_node *));
+    }
+    child->size++, right->size--;
+    return;
+  }
+
+  // Merge the right one of the pair into the left one.
+  if (left) {
+    right = child;
+    pos--;
+  } else {
+    left = child;
+  }
+  assert(right);
+  if (left->is_leaf) {
+    memcpy(left->keys + left->size, right->keys,
+           right->size * sizeof(b_plus_key));
+    memcpy(left->leaf.value + left->size, right->leaf.value,
+           right->size * sizeof(void *));
+    left->size += right->size;
+    left->leaf.next = right->leaf.next;
+  } else {
+    left->keys[left->size] = node->keys[pos];
+    memcpy(left->keys + left->size + 1, right->keys,
+           right->size * sizeof(b_plus_key));
+    memcpy(left->child + left->size + 1, right->child,
+           (right->size + 1) * sizeof(b_plus_node *));
+    left->size += right->size + 1;
+  }
+  free(right);
+  memmove(node->keys + pos, node->keys + pos + 1,
+          (node->size - pos - 1) * sizeof(b_plus_key));
+  memmove(node->child + pos + 1, node->child + pos + 2,
+          (node->size - pos - 1) * sizeof(b_plus_node *));
+  node->size--;
+}
+
+static void *_b_plus_remove(b_plus_node *node, b_plus_key key) {
+  if (node->is_leaf) {
+    uint32_t pos = _b_plus_lower_bound(node, key);
+    if (pos >= node->size || node->keys[pos] != key) {
+      return NULL;
+    }
+    void *value = node->leaf.value[pos];
+    memmove(node->keys + pos, node->keys + pos + 1,
+            (node->size - pos - 1) * sizeof(b_plus_key));
+    memmove(node->leaf.value + pos, node->leaf.value + pos + 1,
+            (node->size - pos - 1) * sizeof(void *));
+    node->size--;
+    return value;
+  }
+
+  uint32_t pos = _b_plus_upper_bound(node, key);
+  void *value = _b_plus_remove(node->child[pos], key);
+  if (value && node->child[pos]->size < B_PLUS_TREE_MIN_KEYS) {
+    _b_plus_fix_child(node, pos);
+  }
+  return value;
+}
+
+// Remove the key and return its value, NULL if the key does not exist.
+void *b_plus_tree_remove(b_plus_tree *tree, b_plus_key key) {
+  if (tree->root == NULL) {
+    return NULL;
+  }
+  void *value = _b_plus_remove(tree->root, key);
+  if (value == NULL) {
+    return NULL;
+  }
+  tree->size--;
+  b_plus_node *root = tree->root;
+  if (!root->is_leaf && root->size == 0) {
+    tree->root = root->child[0];
+    free(root);
+  } else if (root->is_leaf && root->size == 0) {
+    tree->root = NULL;
+    free(root);
+  }
+  return value;
+}
+
+static void _b_plus_free_node(b_plus_node *node) {
+  if (!node->is_leaf) {
+    for (uint32_t i = 0; i <= node->size; i++) {
+      _b_plus_free_node(node->child[i]);
+    }
+  }
+  free(node);
+}
+
+// Release the nodes, the values are left to the caller.
+void destroy_b_plus_tree(b_plus_tree *tree) {
+  if (tree->root) {
+    _b_plus_free_node(tree->root);
+  }
+  tree->root = NULL;
+  tree->size = 0;
+}
+
+size_t b_plus_tree_get_size(b_plus_tree *tree) { return tree->size; }
+
+// Range scan.
+
+typedef struct b_plus_cursor {
+  b_plus_node *leaf;
+  uint32_t pos;
+} b_plus_cursor;
+
+// The cursor at the first key not less than key.
+b_plus_cursor b_plus_tree_lower_bound(b_plus_tree *tree, b_plus_key key) {
+  b_plus_cursor cursor = {NULL, 0};
+  b_plus_node *node = tree->root;
+  if (node == NULL) {
+    return cursor;
+  }
+  while (!node->is_leaf) {
+    node = node->child[_b_plus_upper_bound(node, key)];
+  }
+  cursor.leaf = node;
+  cursor.pos = _b_plus_lower_bound(node, key);
+  if (cursor.pos == node->size) {
+    cursor.leaf = node->leaf.next;
+    cursor.pos = 0;
+  }
+  return cursor;
+}
+
+b_plus_cursor b_plus_tree_begin(b_plus_tree *tree) {
+  b_plus_cursor cursor = {tree->root, 0};
+  if (cursor.leaf == NULL) {
+    return cursor;
+  }
+  while (!cursor.leaf->is_leaf) {
+    cursor.leaf = cursor.leaf->child[0];
+  }
+  return cursor;
+}
+
+bool b_plus_cursor_valid(const b_plus_cursor *cursor) {
+  return cursor->leaf != NULL;
+}
+
+b_plus_key b_plus_cursor_key(const b_plus_cursor *cursor) {
+  return cursor->leaf->keys[cursor->pos];
+}
+
+void *b_plus_cursor_value(const b_plus_cursor *cursor) {
+  return cursor->leaf->leaf.value[cursor->pos];
+}
+
+void b_plus_cursor_next(b_plus_cursor *cursor) {
+  if (++cursor->pos == cursor->leaf->size) {
+    cursor->leaf = cursor->leaf->leaf.next;
+    cursor->pos = 0;
+  }
+}
+
+// Copy the values whose key is in [low, high) into out, at most max of them.
+size_t b_plus_tree_range(b_plus_tree *tree, b_plus_key low, b_plus_key high,
+                         void **out, size_t max) {
+  size_t count = 0;
+  b_plus_cursor cursor = b_plus_tree_lower_bound(tree, low);
+  while (count < max && b_plus_cursor_valid(&cursor) &&
+         b_plus_cursor_key(&cursor) < high) {
+    out[count++] = b_plus_cursor_value(&cursor);
+    b_plus_cursor_next(&cursor);
+  }
+  return count;
+}
+
+// Test code, lookup and insert against rb_tree on random keys.
+// #include "./binary_tree.c"
+// #include <time.h>
+//
+// typedef struct int_node {
+//   b_plus_key key;
+//   binary_node node;
+// } int_node;
+//
+// int int_node_cmp(const binary_node *a, const binary_node *b) {
+//   b_plus_key x = CONTAINER_OF(int_node, node, a)->key,
+//              y = CONTAINER_OF(int_node, node, b)->key;
+//   return (x > y) - (x < y);
+// }
+//
+// b_plus_key int_node_key(const void *value) {
+//   return ((const int_node *)value)->key;
+// }
+//
+// int main() {
+//   size_t sizes[] = {1000000, 10000000, 100000000};
+//   for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+//     size_t n = sizes[s];
+//     int_node *pool = (int_node *)malloc(n * sizeof(int_node));
+//     if (pool == NULL) {
+//       break;
+//     }
+//     uint64_t x = 88172645463325252ull;
+//     for (size_t i = 0; i < n; i++) {
+//       x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+//       pool[i].key = (b_plus_key)(x >> 1);
+//     }
+//
+//     rb_tree rb;
+//     b_plus_tree bp;
+//     clock_t begin;
+//     size_t found = 0;
+//     init_rb_tree(&rb);
+//     init_b_plus_tree(&bp, int_node_key);
+//
+//     begin = clock();
+//     for (size_t i = 0; i < n; i++) {
+//       rb_tree_insert(&rb, &pool[i].node, int_node_cmp);
+//     }
+//     double rb_insert = (double)(clock() - begin) / CLOCKS_PER_SEC;
+//     begin = clock();
+//     for (size_t i = 0; i < n; i++) {
+//       b_plus_tree_insert(&bp, &pool[i]);
+//     }
+//     double bp_insert = (double)(clock() - begin) / CLOCKS_PER_SEC;
+//
+//     begin = clock();
+//     for (size_t i = 0; i < n; i++) {
+//       found += rb_tree_find_node(&rb, &pool[(i * 7919) % n].node,
+//                                  int_node_cmp) != NULL;
+//     }
+//     double rb_find = (double)(clock() - begin) / CLOCKS_PER_SEC;
+//     begin = clock();
+//     for (size_t i = 0; i < n; i++) {
+//       found += b_plus_tree_find(&bp, pool[(i * 7919) % n].key) != NULL;
+//     }
+//     double bp_find = (double)(clock() - begin) / CLOCKS_PER_SEC;
+//
+//     printf("n = %zu, found %zu\n", n, found);
+//     printf("  rb_tree:     insert %.1f ns/op, find %.1f ns/op\n",
+//            rb_insert * 1e9 / n, rb_find * 1e9 / n);
+//     printf("  b_plus_tree: insert %.1f ns/op, find %.1f ns/op\n",
+//            bp_insert * 1e9 / n, bp_find * 1e9 / n);
+//     destroy_b_plus_tree(&bp);
+//     free(pool);
+//   }
+// }
@@ -24,6 +24,13 @@ struct binary_node {
   binary_node *parent;
   binary_node *child[2];
   enum color color;
+#ifdef ENABLE_ORDER_STATISTIC
+  // Number of the nodes in the subtree rooted here, kept by
+  // binary_tree_insert (and so bst_insert), binary_tree_rotate, the insert,
+  // remove, build and merge functions of the rb tree and the image loader.
+  // bst_remove and construct_binary_tree leave it stale or unset.
+  size_t subtree_size;
+#endif
 };
 
 enum traverse_order { PRE, IN, POST };
@@ -35,6 +42,42 @@ typedef struct binary_tree {
 
 typedef binary_tree bTree;
 
+// Store a root or child link. The readers of the concurrent rb tree load the
+// links while the writer relinks the nodes, so there the store is atomic and
+// a release: a reader which loads the link with acquire also sees the payload
+// and the children written into the node before it was linked.
+#ifdef ENABLE_CONCURRENT
+#define _BINARY_LINK_STORE(LINK, NODE) \
+  __atomic_store_n(&(LINK), (NODE), __ATOMIC_RELEASE)
+#else
+#define _BINARY_LINK_STORE(LINK, NODE) ((LINK) = (NODE))
+#endif
+
+#ifdef ENABLE_ORDER_STATISTIC
+static inline size_t _binary_node_subtree_size(const binary_node *node) {
+  return node ? node->subtree_size : 0;
+}
+
+static inline void _binary_node_pull_size(binary_node *node) {
+  node->subtree_size = 1 + _binary_node_subtree_size(node->child[LEFT]) +
+                       _binary_node_subtree_size(node->child[RIGHT]);
+}
+
+// Recount the node and all of its ancestors.
+static inline void _binary_node_pull_size_upward(binary_node *node) {
+  while (node) {
+    _binary_node_pull_size(node);
+    node = node->parent;
+  }
+}
+#else
+static inline void _binary_node_pull_size(binary_node *node) { (void)node; }
+
+static inline void _binary_node_pull_size_upward(binary_node *node) {
+  (void)node;
+}
+#endif
+
 int init_binary_tree(binary_tree *tree) {
   tree->size = 0, tree->root = NULL;
   return 0;
@@ -74,6 +117,7 @@ binary_node *binary_tree_insert(binary_tree *tree, binary_node *node,
     tree->root = new_node;
     new_node->parent = NULL, new_node->child[LEFT] = NULL,
     new_node->child[RIGHT] = NULL;
+    _binary_node_pull_size(new_node);
     return old_node;
   } else {
     binary_node *old_node = node->child[dir];
@@ -81,6 +125,7 @@ binary_node *binary_tree_insert(binary_tree *tree, binary_node *node,
     new_node->child[LEFT] = NULL;
     new_node->child[RIGHT] = NULL;
     new_node->parent = node;
+    _binary_node_pull_size_upward(new_node);
     return old_node;
   }
 }
@@ -93,13 +138,13 @@ binary_node *binary_tree_transplant(binary_tree *tree, binary_node *old_node,
   }
   if (parent == NULL) {
     assert(tree->root == old_node);
-    tree->root = new_node;
+    _BINARY_LINK_STORE(tree->root, new_node);
   } else {
     assert(tree->root != old_node);
     if (parent->child[LEFT] == old_node) {
-      parent->child[LEFT] = new_node;
+      _BINARY_LINK_STORE(parent->child[LEFT], new_node);
     } else if (parent->child[RIGHT] == old_node) {
-      parent->child[RIGHT] = new_node;
+      _BINARY_LINK_STORE(parent->child[RIGHT], new_node);
     } else {
       assert(0);
     }
@@ -169,6 +214,55 @@ void binary_tree_traverse(binary_tree *tree, void (*func)(binary_node *),
   }
 }
 
+// Walk the subtree without recursion by following the parent links, so that a
+// degenerate tree will not overflow the stack. ctx is passed to func as is.
+// In the POST order, func may release the node it is given.
+void binary_node_traverse_ctx(binary_node *root,
+                              void (*func)(binary_node *, void *), void *ctx,
+                              enum traverse_order order) {
+  if (root == NULL) {
+    return;
+  }
+  binary_node *up = root->parent, *prev = up, *curr = root;
+  while (curr != up) {
+    binary_node *next;
+    if (prev == curr->parent) {
+      // Come down from the parent.
+      if (order == PRE) {
+        func(curr, ctx);
+      }
+      if (curr->child[LEFT]) {
+        next = curr->child[LEFT];
+      } else {
+        if (order == IN) {
+          func(curr, ctx);
+        }
+        next = curr->child[RIGHT] ? curr->child[RIGHT] : curr->parent;
+      }
+    } else if (prev == curr->child[LEFT]) {
+      // Come back from the left subtree.
+      if (order == IN) {
+        func(curr, ctx);
+      }
+      next = curr->child[RIGHT] ? curr->child[RIGHT] : curr->parent;
+    } else {
+      // Come back from the right subtree.
+      next = curr->parent;
+    }
+    prev = curr;
+    if (order == POST && next == curr->parent) {
+      func(curr, ctx);
+    }
+    curr = next;
+  }
+}
+
+void binary_tree_traverse_ctx(binary_tree *tree,
+                              void (*func)(binary_node *, void *), void *ctx,
+                              enum traverse_order order) {
+  binary_node_traverse_ctx(tree->root, func, ctx, order);
+}
+
 void binary_node_switch_order(binary_node *node) {
   binary_node *tmp = node->child[LEFT];
   node->child[LEFT] = node->child[RIGHT];
@@ -180,6 +274,7 @@ void binary_tree_reverse(binary_tree *tree) {
 }
 
 #define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
 size_t binary_node_height(binary_node *node) {
   if (node == NULL) {
@@ -237,6 +332,161 @@ void __free_binary_root_with_offset(binary_node *root, size_t offset) {
   __free_binary_root_with_offset(((TREE_PTR)->root),     \
                                  (offsetof(NODE_TYPE, MEMBER)))
 
+// Node pool.
+// A typed slab allocator for the nodes of one (or several) trees. Nodes are
+// carved out of big slabs and freed nodes are kept on a free list, so a
+// workload which keeps inserting and removing short-lived nodes (Dijkstra,
+// Huffman) does not go through malloc / free for every node. All slabs are
+// released at once by destroy_binary_node_pool.
+// Notice: the pool is not thread safe, use one pool per tree or per thread.
+
+#define BINARY_NODE_POOL_MIN_SLAB 64
+#define BINARY_NODE_POOL_MAX_SLAB 65536
+
+typedef struct _binary_node_slab {
+  struct _binary_node_slab *next;
+  size_t capacity;
+} _binary_node_slab;
+
+typedef struct binary_node_pool {
+  size_t node_size;
+  size_t offset;
+  void *free_list;
+  char *bump, *bump_end;
+  _binary_node_slab *slabs;
+  size_t next_slab_capacity;
+  size_t in_use;
+} binary_node_pool;
+
+// The header of a slab is padded so that the nodes inside keep the alignment
+// malloc would give them.
+#define _BINARY_NODE_SLAB_HEADER                                 \
+  ((sizeof(_binary_node_slab) + sizeof(long double) - 1) /       \
+   sizeof(long double) * sizeof(long double))
+
+int _init_binary_node_pool_(binary_node_pool *pool, size_t node_size,
+                            size_t offset) {
+  if (pool == NULL) {
+    return -1;
+  }
+  if (node_size < sizeof(void *)) {
+    node_size = sizeof(void *);
+  }
+  // Keep every node aligned in the same way as malloc does.
+  node_size = (node_size + sizeof(long double) - 1) / sizeof(long double) *
+              sizeof(long double);
+  pool->node_size = node_size, pool->offset = offset;
+  pool->free_list = NULL;
+  pool->bump = NULL, pool->bump_end = NULL;
+  pool->slabs = NULL;
+  pool->next_slab_capacity = BINARY_NODE_POOL_MIN_SLAB;
+  pool->in_use = 0;
+  return 0;
+}
+
+#define INIT_BINARY_NODE_POOL(NODE_TYPE, MEMBER, POOL_PTR)   \
+  _init_binary_node_pool_((POOL_PTR), sizeof(NODE_TYPE), \
+                          offsetof(NODE_TYPE, MEMBER))
+
+static inline int _binary_node_pool_grow(binary_node_pool *pool) {
+  size_t capacity = pool->next_slab_capacity;
+  _binary_node_slab *slab = (_binary_node_slab *)malloc(
+      _BINARY_NODE_SLAB_HEADER + capacity * pool->node_size);
+#ifdef __GNUC__
+  if (unlikely(!slab)) {
+#else
+  if (!slab) {
+#endif
+    return -1;
+  }
+  slab->capacity = capacity;
+  slab->next = pool->slabs;
+  pool->slabs = slab;
+  pool->bump = (char *)slab + _BINARY_NODE_SLAB_HEADER;
+  pool->bump_end = pool->bump + capacity * pool->node_size;
+  if (capacity < BINARY_NODE_POOL_MAX_SLAB) {
+    pool->next_slab_capacity = capacity * 2;
+  }
+  return 0;
+}
+
+void *__pool_alloc_with_offset(binary_node_pool *pool, size_t size,
+                               size_t offset) {
+  assert(pool->offset == offset);
+  assert(size <= pool->node_size);
+  void *ptr;
+  if (pool->free_list) {
+    ptr = pool->free_list;
+    pool->free_list = *(void **)ptr;
+  } else {
+    if (pool->bump == pool->bump_end && _binary_node_pool_grow(pool)) {
+      return NULL;
+    }
+    ptr = pool->bump;
+    pool->bump += pool->node_size;
+  }
+  pool->in_use++;
+  return (void *)((char *)ptr + offset);
+}
+
+void __pool_release_with_offset(binary_node_pool *pool, void *ptr,
+                                size_t offset) {
+  if (ptr == NULL) {
+    return;
+  }
+  assert(pool->offset == offset);
+  void *obj = (void *)((char *)ptr - offset);
+  *(void **)obj = pool->free_list;
+  pool->free_list = obj;
+  pool->in_use--;
+}
+
+void __pool_free_binary_root_with_offset(binary_node_pool *pool,
+                                         binary_node *root, size_t offset) {
+  if (root == NULL) {
+    return;
+  }
+  __pool_free_binary_root_with_offset(pool, root->child[LEFT], offset);
+  __pool_free_binary_root_with_offset(pool, root->child[RIGHT], offset);
+  __pool_release_with_offset(pool, root, offset);
+}
+
+// Release every slab of the pool, every node allocated from it becomes
+// invalid, no matter which tree it belongs to.
+void destroy_binary_node_pool(binary_node_pool *pool) {
+  _binary_node_slab *slab = pool->slabs;
+  while (slab) {
+    _binary_node_slab *next = slab->next;
+    free(slab);
+    slab = next;
+  }
+  pool->slabs = NULL;
+  pool->free_list = NULL;
+  pool->bump = NULL, pool->bump_end = NULL;
+  pool->next_slab_capacity = BINARY_NODE_POOL_MIN_SLAB;
+  pool->in_use = 0;
+}
+
+size_t binary_node_pool_in_use(binary_node_pool *pool) { return pool->in_use; }
+
+#define MAKE_BINARY_NODE_IN_POOL(NODE_TYPE, MEMBER, POOL_PTR)    \
+  ((binary_node *)__pool_alloc_with_offset(                      \
+      (POOL_PTR), sizeof(NODE_TYPE), offsetof(NODE_TYPE, MEMBER)))
+
+#define FREE_BINARY_NODE_IN_POOL(NODE_TYPE, MEMBER, POOL_PTR, NODE_PTR) \
+  __pool_release_with_offset((POOL_PTR), (NODE_PTR),                    \
+                             offsetof(NODE_TYPE, MEMBER))
+
+// Give all the nodes of the tree back to the pool, the slabs are kept for
+// reuse. Use destroy_binary_node_pool to drop the memory itself.
+#define DESTROY_BINARY_TREE_IN_POOL(NODE_TYPE, MEMBER, TREE_PTR, POOL_PTR) \
+  do {                                                                     \
+    __pool_free_binary_root_with_offset((POOL_PTR), ((TREE_PTR)->root),    \
+                                        (offsetof(NODE_TYPE, MEMBER)));    \
+    (TREE_PTR)->root = NULL;                                               \
+    (TREE_PTR)->size = 0;                                                  \
+  } while (0)
+
 int binary_tree_rotate(binary_tree *tree, binary_node *node,
                        enum direction dir) {
   if (node == NULL || tree == NULL) {
@@ -253,16 +503,18 @@ int binary_tree_rotate(binary_tree *tree, binary_node *node,
 
         binary_node *old_root = node, *new_root = node->child[RIGHT],
                     *child_to_swap = node->child[RIGHT]->child[LEFT];
-        tree->root = new_root;
+        _BINARY_LINK_STORE(tree->root, new_root);
 
-        new_root->child[LEFT] = old_root;
-        old_root->child[RIGHT] = child_to_swap;
+        _BINARY_LINK_STORE(new_root->child[LEFT], old_root);
+        _BINARY_LINK_STORE(old_root->child[RIGHT], child_to_swap);
 
         if (child_to_swap != NULL) {
           child_to_swap->parent = old_root;
         }
         old_root->parent = new_root;
         new_root->parent = NULL;
+        _binary_node_pull_size(old_root);
+        _binary_node_pull_size(new_root);
 
         return 0;
       }
@@ -273,16 +525,18 @@ int binary_tree_rotate(binary_tree *tree, binary_node *node,
 
         binary_node *old_root = node, *new_root = node->child[LEFT],
                     *child_to_swap = node->child[LEFT]->child[RIGHT];
-        tree->root = new_root;
+        _BINARY_LINK_STORE(tree->root, new_root);
 
-        new_root->child[RIGHT] = old_root;
-        old_root->child[LEFT] = child_to_swap;
+        _BINARY_LINK_STORE(new_root->child[RIGHT], old_root);
+        _BINARY_LINK_STORE(old_root->child[LEFT], child_to_swap);
 
         if (child_to_swap != NULL) {
           child_to_swap->parent = old_root;
         }
         old_root->parent = new_root;
         new_root->parent = NULL;
+        _binary_node_pull_size(old_root);
+        _binary_node_pull_size(new_root);
 
         return 0;
       }
@@ -302,20 +556,22 @@ int binary_tree_rotate(binary_tree *tree, binary_node *node,
 
       assert(!(node == parent->child[LEFT] && node == parent->child[RIGHT]));
       if (node == parent->child[LEFT]) {
-        parent->child[LEFT] = new_root;
+        _BINARY_LINK_STORE(parent->child[LEFT], new_root);
       } else if (node == parent->child[RIGHT]) {
-        parent->child[RIGHT] = new_root;
+        _BINARY_LINK_STORE(parent->child[RIGHT], new_root);
       } else {
         assert(0);
       }
 
-      new_root->child[LEFT] = old_root;
-      old_root->child[RIGHT] = child_to_swap;
+      _BINARY_LINK_STORE(new_root->child[LEFT], old_root);
+      _BINARY_LINK_STORE(old_root->child[RIGHT], child_to_swap);
       if (child_to_swap != NULL) {
         child_to_swap->parent = old_root;
       }
       old_root->parent = new_root;
       new_root->parent = parent;
+      _binary_node_pull_size(old_root);
+      _binary_node_pull_size(new_root);
 
       return 0;
     }
@@ -329,20 +585,22 @@ int binary_tree_rotate(binary_tree *tree, binary_node *node,
 
       assert(!(node == parent->child[LEFT] && node == parent->child[RIGHT]));
       if (node == parent->child[LEFT]) {
-        parent->child[LEFT] = new_root;
+        _BINARY_LINK_STORE(parent->child[LEFT], new_root);
       } else if (node == parent->child[RIGHT]) {
-        parent->child[RIGHT] = new_root;
+        _BINARY_LINK_STORE(parent->child[RIGHT], new_root);
       } else {
         assert(0);
       }
 
-      new_root->child[RIGHT] = old_root;
-      old_root->child[LEFT] = child_to_swap;
+      _BINARY_LINK_STORE(new_root->child[RIGHT], old_root);
+      _BINARY_LINK_STORE(old_root->child[LEFT], child_to_swap);
       if (child_to_swap != NULL) {
         child_to_swap->parent = old_root;
       }
       old_root->parent = new_root;
       new_root->parent = parent;
+      _binary_node_pull_size(old_root);
+      _binary_node_pull_size(new_root);
 
       return 0;
     }
@@ -385,6 +643,211 @@ binary_node *binary_tree_find_lowest_ancestor(binary_tree *tree,
   return binary_node_find_lowest_ancestor(tree->root, node1, node2);
 }
 
+// LCA index.
+// The lowest common ancestor of two nodes is the shallowest node between them
+// in the in order sequence (the binary tree form of the Euler tour trick), so
+// after an O(n log n) preprocessing with a sparse table over the depths of the
+// in order sequence, every query is O(1). The nodes are mapped to their in
+// order positions by an open addressing table keyed by address.
+// Notice: the index is a snapshot, rebuild it after the tree changes.
+
+typedef struct binary_tree_lca_index {
+  size_t size;
+  binary_node **order;
+  uint32_t *depth;
+  // sparse[k * size + i] is the position of the shallowest node in
+  // [i, i + 2^k).
+  uint32_t *sparse;
+  size_t levels;
+  binary_node **slot_node;
+  uint32_t *slot_pos;
+  size_t slot_mask;
+} binary_tree_lca_index;
+
+static inline size_t _lca_log2(size_t n) {
+#ifdef __GNUC__
+  return (size_t)(sizeof(unsigned long long) * 8 - 1 -
+                  __builtin_clzll((unsigned long long)n));
+#else
+  size_t res = 0;
+  while (n >>= 1) {
+    res++;
+  }
+  return res;
+#endif
+}
+
+static inline size_t _lca_hash(const binary_node *node, size_t mask) {
+  return (size_t)(((uint64_t)(uintptr_t)node >> 4) * 0x9E3779B97F4A7C15ull >>
+                  32) &
+         mask;
+}
+
+static inline uint32_t _lca_shallower(const binary_tree_lca_index *index,
+                                      uint32_t a, uint32_t b) {
+  return index->depth[a] <= index->depth[b] ? a : b;
+}
+
+void destroy_binary_tree_lca_index(binary_tree_lca_index *index) {
+  free(index->order);
+  free(index->depth);
+  free(index->sparse);
+  free(index->slot_node);
+  free(index->slot_pos);
+  memset(index, 0, sizeof(*index));
+}
+
+// Count the nodes with the parent links, so a deep tree does not overflow
+// the stack as binary_node_get_size does. tree->size is not trusted for it is
+// not kept by binary_tree_insert.
+static size_t _lca_count_nodes(binary_node *root) {
+  binary_node *prev = NULL, *curr = root;
+  size_t n = 0;
+  while (curr) {
+    binary_node *next;
+    if (prev == curr->parent) {
+      n++;
+      next = curr->child[LEFT]    ? curr->child[LEFT]
+             : curr->child[RIGHT] ? curr->child[RIGHT]
+                                  : curr->parent;
+    } else if (prev == curr->child[LEFT] && curr->child[RIGHT]) {
+      next = curr->child[RIGHT];
+    } else {
+      next = curr->parent;
+    }
+    prev = curr;
+    curr = next;
+  }
+  return n;
+}
+
+// 0 for success, -1 if the memory is used up or the tree is too large.
+int binary_tree_build_lca_index(binary_tree *tree,
+                                binary_tree_lca_index *index) {
+  memset(index, 0, sizeof(*index));
+  size_t n = _lca_count_nodes(tree->root);
+  if (n == 0) {
+    return 0;
+  }
+  if (n >= UINT32_MAX) {
+    return -1;
+  }
+  size_t slots = 2;
+  while (slots < 2 * n) {
+    slots <<= 1;
+  }
+  index->size = n;
+  index->levels = _lca_log2(n) + 1;
+  index->slot_mask = slots - 1;
+  index->order = (binary_node **)malloc(n * sizeof(binary_node *));
+  index->depth = (uint32_t *)malloc(n * sizeof(uint32_t));
+  index->sparse = (uint32_t *)malloc(index->levels * n * sizeof(uint32_t));
+  index->slot_node = (binary_node **)calloc(slots, sizeof(binary_node *));
+  index->slot_pos = (uint32_t *)malloc(slots * sizeof(uint32_t));
+  if (!index->order || !index->depth || !index->sparse || !index->slot_node ||
+      !index->slot_pos) {
+    destroy_binary_tree_lca_index(index);
+    return -1;
+  }
+
+  // In order walk with the parent links, keeping track of the depth.
+  binary_node *prev = NULL, *curr = tree->root;
+  uint32_t depth = 0, pos = 0;
+  while (curr) {
+    binary_node *next;
+    bool visit = false;
+    if (prev == curr->parent) {
+      if (curr->child[LEFT]) {
+        next = curr->child[LEFT];
+      } else {
+        visit = true;
+        next = curr->child[RIGHT] ? curr->child[RIGHT] : curr->parent;
+      }
+    } else if (prev == curr->child[LEFT]) {
+      visit = true;
+      next = curr->child[RIGHT] ? curr->child[RIGHT] : curr->parent;
+    } else {
+      next = curr->parent;
+    }
+    if (visit) {
+      index->order[pos] = curr;
+      index->depth[pos] = depth;
+      size_t slot = _lca_hash(curr, index->slot_mask);
+      while (index->slot_node[slot]) {
+        slot = (slot + 1) & index->slot_mask;
+      }
+      index->slot_node[slot] = curr;
+      index->slot_pos[slot] = pos;
+      pos++;
+    }
+    if (next == curr->parent) {
+      depth--;
+    } else {
+      depth++;
+    }
+    prev = curr;
+    curr = next;
+  }
+  assert(pos == n);
+
+  for (uint32_t i = 0; i < n; i++) {
+    index->sparse[i] = i;
+  }
+  for (size_t k = 1; k < index->levels; k++) {
+    uint32_t *row = index->sparse + k * n, *last = row - n;
+    size_t half = (size_t)1 << (k - 1);
+    for (size_t i = 0; i + (half << 1) <= n; i++) {
+      row[i] = _lca_shallower(index, last[i], last[i + half]);
+    }
+  }
+  return 0;
+}
+
+static inline bool _lca_position(const binary_tree_lca_index *index,
+                                 const binary_node *node, uint32_t *pos) {
+  if (index->size == 0 || node == NULL) {
+    return false;
+  }
+  size_t slot = _lca_hash(node, index->slot_mask);
+  while (index->slot_node[slot]) {
+    if (index->slot_node[slot] == node) {
+      *pos = index->slot_pos[slot];
+      return true;
+    }
+    slot = (slot + 1) & index->slot_mask;
+  }
+  return false;
+}
+
+// NULL if any of the nodes is not in the indexed tree.
+binary_node *binary_tree_lca_query(const binary_tree_lca_index *index,
+                                   const binary_node *node1,
+                                   const binary_node *node2) {
+  uint32_t a, b;
+  if (!_lca_position(index, node1, &a) || !_lca_position(index, node2, &b)) {
+    return NULL;
+  }
+  if (a > b) {
+    uint32_t mid = a;
+    a = b;
+    b = mid;
+  }
+  size_t k = _lca_log2(b - a + 1);
+  const uint32_t *row = index->sparse + k * index->size;
+  return index->order[_lca_shallower(index, row[a],
+                                     row[b + 1 - ((size_t)1 << k)])];
+}
+
+// res[i] is the lowest common ancestor of node1[i] and node2[i].
+void binary_tree_lca_query_batch(const binary_tree_lca_index *index,
+                                 binary_node *const *node1,
+                                 binary_node *const *node2, binary_node **res,
+                                 size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    res[i] = binary_tree_lca_query(index, node1[i], node2[i]);
+  }
+}
+
 #ifdef ENABLE_QUEUE
 
 #include "./linked_list.c"
@@ -394,9 +857,13 @@ void binary_node_level_order(binary_node *root, void (*func)(binary_node *)) {
     binary_node *target;
     intrusive_node node;
   } bfs_node;
+  // Every visited node passes through the queue, the pool recycles the
+  // entries instead of a malloc / free for each.
+  list_node_pool pool;
+  INIT_LIST_NODE_POOL(bfs_node, node, &pool);
   linked_queue queue;
   init_linked_queue(&queue);
-  intrusive_node *nRoot = MAKE_NODE(bfs_node, node);
+  intrusive_node *nRoot = MAKE_NODE_IN_POOL(bfs_node, node, &pool);
   CONTAINER_OF(bfs_node, node, nRoot)->target = root;
   linked_queue_push(&queue, nRoot);
   nRoot = NULL;
@@ -406,71 +873,52 @@ void binary_node_level_order(binary_node *root, void (*func)(binary_node *)) {
     func(CONTAINER_OF(bfs_node, node, node_to_proc)->target);
     if (CONTAINER_OF(bfs_node, node, node_to_proc)->target->child[LEFT] !=
         NULL) {
-      intrusive_node *nNode = MAKE_NODE(bfs_node, node);
+      intrusive_node *nNode = MAKE_NODE_IN_POOL(bfs_node, node, &pool);
       CONTAINER_OF(bfs_node, node, nNode)->target =
           CONTAINER_OF(bfs_node, node, node_to_proc)->target->child[LEFT];
       linked_queue_push(&queue, nNode);
     }
     if (CONTAINER_OF(bfs_node, node, node_to_proc)->target->child[RIGHT] !=
         NULL) {
-      intrusive_node *nNode = MAKE_NODE(bfs_node, node);
+      intrusive_node *nNode = MAKE_NODE_IN_POOL(bfs_node, node, &pool);
       CONTAINER_OF(bfs_node, node, nNode)->target =
           CONTAINER_OF(bfs_node, node, node_to_proc)->target->child[RIGHT];
       linked_queue_push(&queue, nNode);
     }
-    RELEASE_NODE(bfs_node, node, node_to_proc);
+    RELEASE_NODE_IN_POOL(bfs_node, node, node_to_proc, &pool);
   }
+  _free_empty_circular_linked_list_(&queue);
+  destroy_list_node_pool(&pool);
 }
 
 #endif
 
+// Build the tree from PRE / POST order and the in order sequence in linear
+// time. The stack holds the nodes whose second child is not yet known, the
+// next node in the sequence is the first child of the top unless the top has
+// just been reached in the in order sequence, in which case it becomes the
+// second child of the last node popped. POST is handled as PRE in reverse
+// with the two children swapped. Returns NULL if len is 0 or the stack cannot
+// be allocated.
 binary_node *construct_binary_tree(binary_node **node_list_mid,
                                    binary_node **node_list, size_t len,
                                    enum traverse_order seq) {
+  if (len < 1) {
+    return NULL;
+  }
+
+  int first, second;
+  ptrdiff_t pos, mid_pos, step;
   switch (seq) {
     case PRE: {
-      if (len < 1) {
-        return NULL;
-      }
-      binary_node *root = node_list[0];
-      if (len == 1) {
-        root->child[LEFT] = NULL;
-        root->child[RIGHT] = NULL;
-        return root;
-      }
-      size_t pos;
-      for (pos = 0; pos < len; pos++) {
-        if (node_list_mid[pos] == root) {
-          break;
-        }
-      }
-      root->child[LEFT] =
-          construct_binary_tree(node_list_mid, node_list + 1, pos, seq);
-      root->child[RIGHT] = construct_binary_tree(
-          node_list_mid + pos + 1, node_list + pos + 1, len - pos - 1, seq);
-      return root;
+      first = LEFT, second = RIGHT;
+      pos = 0, mid_pos = 0, step = 1;
+      break;
     }
     case POST: {
-      if (len < 1) {
-        return NULL;
-      }
-      binary_node *root = node_list[len - 1];
-      if (len == 1) {
-        root->child[LEFT] = NULL;
-        root->child[RIGHT] = NULL;
-        return root;
-      }
-      size_t pos;
-      for (pos = 0; pos < len; pos++) {
-        if (node_list_mid[pos] == root) {
-          break;
-        }
-      }
-      root->child[LEFT] =
-          construct_binary_tree(node_list_mid, node_list, pos, seq);
-      root->child[RIGHT] = construct_binary_tree(
-          node_list_mid + pos + 1, node_list + pos, len - pos - 1, seq);
-      return root;
+      first = RIGHT, second = LEFT;
+      pos = len - 1, mid_pos = len - 1, step = -1;
+      break;
     }
     case IN: {
       assert(0);
@@ -479,6 +927,45 @@ binary_node *construct_binary_tree(binary_node **node_list_mid,
       assert(0);
     }
   }
+
+  binary_node **stack = (binary_node **)malloc(sizeof(binary_node *) * len);
+#ifdef __GNUC__
+  if (unlikely(stack == NULL)) {
+#else
+  if (stack == NULL) {
+#endif
+    perror("Fail to allocate the stack");
+    return NULL;
+  }
+
+  binary_node *root = node_list[pos];
+  root->parent = NULL;
+  root->child[LEFT] = root->child[RIGHT] = NULL;
+  size_t top = 0;
+  stack[top++] = root;
+
+  for (size_t i = 1; i < len; i++) {
+    pos += step;
+    binary_node *curr = node_list[pos];
+    curr->child[LEFT] = curr->child[RIGHT] = NULL;
+
+    if (stack[top - 1] != node_list_mid[mid_pos]) {
+      stack[top - 1]->child[first] = curr;
+      curr->parent = stack[top - 1];
+    } else {
+      binary_node *parent = NULL;
+      while (top > 0 && stack[top - 1] == node_list_mid[mid_pos]) {
+        parent = stack[--top];
+        mid_pos += step;
+      }
+      parent->child[second] = curr;
+      curr->parent = parent;
+    }
+    stack[top++] = curr;
+  }
+
+  free(stack);
+  return root;
 }
 
 struct _internal_node_pair {
@@ -759,39 +1246,296 @@ binary_node *bst_get_greatest(binary_tree *tree) {
   return it;
 }
 
-// RB Tree
+// Cursor.
+// Step through the tree in order with the parent links, amortized O(1) for
+// each step, no recursion and no allocation. NULL is returned at the end.
 
-typedef binary_tree rb_tree;
+bst_node *bst_first(bst *tree) { return bst_get_smallest(tree); }
 
-int init_rb_tree(rb_tree *tree) { return init_binary_tree(tree); }
+bst_node *bst_last(bst *tree) { return bst_get_greatest(tree); }
 
-static inline binary_node *_rbTree_get_grandpa(binary_node *node) {
-  binary_node *parent = node->parent;
-  if (parent == NULL) {
-    return parent;
+bst_node *bst_next(bst_node *node) {
+  if (node == NULL) {
+    return NULL;
   }
-  binary_node *grandpa = parent->parent;
-  return grandpa;
+  if (node->child[RIGHT]) {
+    node = node->child[RIGHT];
+    while (node->child[LEFT]) {
+      node = node->child[LEFT];
+    }
+    return node;
+  }
+  bst_node *parent = node->parent;
+  while (parent && node == parent->child[RIGHT]) {
+    node = parent;
+    parent = parent->parent;
+  }
+  return parent;
 }
 
-static inline binary_node *_rbTree_get_uncle(binary_node *node) {
-  binary_node *parent = node->parent;
-  if (parent == NULL) {
-    return parent;
-  }
-  binary_node *grandpa = parent->parent;
-  if (grandpa == NULL) {
+bst_node *bst_prev(bst_node *node) {
+  if (node == NULL) {
     return NULL;
   }
-  if (parent == grandpa->child[LEFT]) {
-    return grandpa->child[RIGHT];
-  } else if (parent == grandpa->child[RIGHT]) {
-    return grandpa->child[LEFT];
+  if (node->child[LEFT]) {
+    node = node->child[LEFT];
+    while (node->child[RIGHT]) {
+      node = node->child[RIGHT];
+    }
+    return node;
+  }
+  bst_node *parent = node->parent;
+  while (parent && node == parent->child[LEFT]) {
+    node = parent;
+    parent = parent->parent;
+  }
+  return parent;
+}
+
+// Whether node lies beyond key in the direction dir, or on it if inclusive.
+static inline bool _bst_beyond(const bst_node *node, const bst_node *key,
+                               int (*cmp)(const bst_node *, const bst_node *),
+                               enum direction dir, bool inclusive) {
+  int res = cmp(node, key);
+  if (dir == LEFT) {
+    res = -res;
+  }
+  return res > 0 || (res == 0 && inclusive);
+}
+
+static inline bst_node *_bst_seek_from(
+    bst_node *curr, const bst_node *key,
+    int (*cmp)(const bst_node *, const bst_node *), enum direction dir,
+    bool inclusive, bst_node *res) {
+  while (curr) {
+    if (_bst_beyond(curr, key, cmp, dir, inclusive)) {
+      res = curr;
+      curr = curr->child[!dir];
+    } else {
+      curr = curr->child[dir];
+    }
+  }
+  return res;
+}
+
+// The nearest node to key in the direction dir: with dir RIGHT the smallest
+// node not less than key (greater than key if !inclusive), with dir LEFT the
+// greatest node not greater than key (less than key if !inclusive).
+bst_node *bst_seek(bst *tree, const bst_node *key,
+                   int (*cmp)(const bst_node *, const bst_node *),
+                   enum direction dir, bool inclusive) {
+  return _bst_seek_from(tree->root, key, cmp, dir, inclusive, NULL);
+}
+
+// Resumable cursor over a bst, ascending or descending.
+// A page of k nodes costs O(log n + k): the start is found by one descent
+// and the following nodes by bst_next / bst_prev, whose cost is amortized
+// O(1). The cursor holds the node to be read next, so the tree must not be
+// changed between two reads. To go on after a change, seek again from the
+// last node read with inclusive set to false.
+typedef struct bst_range_cursor {
+  bst_node *next;
+  enum direction dir;
+} bst_range_cursor;
+
+// dir RIGHT reads ascending, LEFT descending. A NULL key starts from the
+// first or the last node.
+void bst_range_cursor_seek(bst_range_cursor *cursor, bst *tree,
+                           const bst_node *key,
+                           int (*cmp)(const bst_node *, const bst_node *),
+                           enum direction dir, bool inclusive) {
+  cursor->dir = dir;
+  if (key == NULL) {
+    cursor->next = dir == RIGHT ? bst_first(tree) : bst_last(tree);
   } else {
-    assert(0);
+    cursor->next = bst_seek(tree, key, cmp, dir, inclusive);
   }
 }
 
+// Copy at most k nodes into buffer and return how many were copied. Fewer
+// than k means the end of the tree was reached.
+size_t bst_range_cursor_read(bst_range_cursor *cursor, bst_node **buffer,
+                             size_t k) {
+  size_t cnt = 0;
+  bst_node *curr = cursor->next;
+  while (curr && cnt < k) {
+    buffer[cnt++] = curr;
+    curr = cursor->dir == RIGHT ? bst_next(curr) : bst_prev(curr);
+  }
+  cursor->next = curr;
+  return cnt;
+}
+
+bool bst_range_cursor_done(const bst_range_cursor *cursor) {
+  return cursor->next == NULL;
+}
+
+// Batch queries.
+// The probes are sorted once, then answered in order, each one starting from
+// the answer to the one before instead of from the root, so that m probes
+// over n nodes cost O(m log m) for the sort plus at most O(n + m) for the
+// walk, much less when the probes are sparse.
+
+// Sort the indices of the probes by key, bottom up merge sort.
+static int _bst_sort_probes(const bst_node **keys, size_t m,
+                            int (*cmp)(const bst_node *, const bst_node *),
+                            size_t *order) {
+  size_t *buffer = (size_t *)malloc(sizeof(size_t) * (m ? m : 1));
+#ifdef __GNUC__
+  if (unlikely(buffer == NULL)) {
+#else
+  if (buffer == NULL) {
+#endif
+    perror("Fail to allocate the probe buffer");
+    return -2;
+  }
+  for (size_t i = 0; i < m; i++) {
+    order[i] = i;
+  }
+  size_t *from = order, *to = buffer;
+  for (size_t width = 1; width < m; width *= 2) {
+    for (size_t begin = 0; begin < m; begin += 2 * width) {
+      size_t mid = MIN(begin + width, m), end = MIN(begin + 2 * width, m);
+      size_t i = begin, j = mid, k = begin;
+      while (i < mid && j < end) {
+        to[k++] = cmp(keys[from[j]], keys[from[i]]) < 0 ? from[j++] : from[i++];
+      }
+      while (i < mid) {
+        to[k++] = from[i++];
+      }
+      while (j < end) {
+        to[k++] = from[j++];
+      }
+    }
+    size_t *tmp = from;
+    from = to, to = tmp;
+  }
+  if (from != order) {
+    memcpy(order, from, sizeof(size_t) * m);
+  }
+  free(buffer);
+  return 0;
+}
+
+// The nearest node beyond key in the direction dir, given a node finger which
+// is not beyond it. The nodes after finger are the subtree on its dir side,
+// then the first ancestor it lies on the other side of, and so on.
+static inline bst_node *_bst_finger_seek(
+    bst_node *finger, const bst_node *key,
+    int (*cmp)(const bst_node *, const bst_node *), enum direction dir,
+    bool inclusive) {
+  while (true) {
+    bst_node *curr = finger, *parent = finger->parent;
+    while (parent && curr == parent->child[dir]) {
+      curr = parent;
+      parent = parent->parent;
+    }
+    if (parent == NULL || _bst_beyond(parent, key, cmp, dir, inclusive)) {
+      return _bst_seek_from(finger->child[dir], key, cmp, dir, inclusive,
+                            parent);
+    }
+    finger = parent;
+  }
+}
+
+// res[i] = bst_seek(tree, keys[i], cmp, dir, inclusive) for all the m
+// probes. Returns 0 on success and -2 if the memory cannot be allocated.
+int bst_batch_seek(bst *tree, const bst_node **keys, size_t m,
+                   int (*cmp)(const bst_node *, const bst_node *),
+                   enum direction dir, bool inclusive, bst_node **res) {
+  size_t *order = (size_t *)malloc(sizeof(size_t) * (m ? m : 1));
+#ifdef __GNUC__
+  if (unlikely(order == NULL)) {
+#else
+  if (order == NULL) {
+#endif
+    perror("Fail to allocate the probe order");
+    return -2;
+  }
+  if (_bst_sort_probes(keys, m, cmp, order)) {
+    free(order);
+    return -2;
+  }
+
+  // Walk the probes in the direction dir, so that every answer is at or
+  // beyond the one before.
+  bst_node *prev = NULL;
+  for (size_t i = 0; i < m; i++) {
+    size_t probe = dir == RIGHT ? order[i] : order[m - 1 - i];
+    if (i == 0) {
+      prev = bst_seek(tree, keys[probe], cmp, dir, inclusive);
+    } else if (prev && !_bst_beyond(prev, keys[probe], cmp, dir, inclusive)) {
+      prev = _bst_finger_seek(prev, keys[probe], cmp, dir, inclusive);
+    }
+    res[probe] = prev;
+  }
+
+  free(order);
+  return 0;
+}
+
+// res[i] is the level of the node equal to keys[i], the root being 1, or 0 if
+// there is none. One in order sweep over the tree, stopped once the probes
+// run out. Returns 0 on success and -2 if the memory cannot be allocated.
+int bst_batch_level(bst *tree, const bst_node **keys, size_t m,
+                    int (*cmp)(const bst_node *, const bst_node *),
+                    size_t *res) {
+  size_t *order = (size_t *)malloc(sizeof(size_t) * (m ? m : 1));
+#ifdef __GNUC__
+  if (unlikely(order == NULL)) {
+#else
+  if (order == NULL) {
+#endif
+    perror("Fail to allocate the probe order");
+    return -2;
+  }
+  if (_bst_sort_probes(keys, m, cmp, order)) {
+    free(order);
+    return -2;
+  }
+
+  size_t i = 0, level = 1;
+  bst_node *curr = tree->root;
+  while (curr && curr->child[LEFT]) {
+    curr = curr->child[LEFT];
+    level++;
+  }
+  while (curr && i < m) {
+    int c;
+    while (i < m && (c = cmp(curr, keys[order[i]])) >= 0) {
+      res[order[i++]] = c == 0 ? level : 0;
+    }
+    // Next in order.
+    if (curr->child[RIGHT]) {
+      curr = curr->child[RIGHT];
+      level++;
+      while (curr->child[LEFT]) {
+        curr = curr->child[LEFT];
+        level++;
+      }
+    } else {
+      while (curr->parent && curr == curr->parent->child[RIGHT]) {
+        curr = curr->parent;
+        level--;
+      }
+      curr = curr->parent;
+      level--;
+    }
+  }
+  while (i < m) {
+    res[order[i++]] = 0;
+  }
+
+  free(order);
+  return 0;
+}
+
+// RB Tree
+
+typedef binary_tree rb_tree;
+
+int init_rb_tree(rb_tree *tree) { return init_binary_tree(tree); }
+
 static inline enum color _rbTree_color(binary_node *node) {
   if (node == NULL) {
     return BLACK;
@@ -800,64 +1544,71 @@ static inline enum color _rbTree_color(binary_node *node) {
   }
 }
 
-static inline void _rbTree_set_insert_balance(rb_tree *tree,
-                                              binary_node *node) {
-  // Maintain the balance.
-  if (node == tree->root) {
-    node->color = BLACK;
-  } else if (_rbTree_color(node->parent) == RED &&
-             _rbTree_color(_rbTree_get_uncle(node)) == RED) {
-    binary_node *parent = node->parent, *uncle = _rbTree_get_uncle(node),
-                *grandpa = _rbTree_get_grandpa(node);
-    parent->color = BLACK, uncle->color = BLACK, grandpa->color = RED;
-    _rbTree_set_insert_balance(tree, grandpa);
-  } else if (_rbTree_color(node->parent) == RED &&
-             _rbTree_color(_rbTree_get_uncle(node)) == BLACK) {
-    binary_node *parent = node->parent,
-                *grandpa = _rbTree_get_grandpa(node);
-    if (parent == grandpa->child[LEFT] && node == parent->child[RIGHT]) {
-      binary_tree_rotate(tree, parent, LEFT);
-      binary_node *mid = node;
-      node = parent;
-      parent = mid;
-    } else if (parent == grandpa->child[RIGHT] && node == parent->child[LEFT]) {
-      binary_tree_rotate(tree, parent, RIGHT);
-      binary_node *mid = node;
+// Repair the red node from the bottom up. The parent, grandpa and uncle are
+// read once for each level and kept in locals.
+static inline void _rbTree_insert_fixup(rb_tree *tree, binary_node *node) {
+  binary_node *parent;
+  while ((parent = node->parent) != NULL && parent->color == RED) {
+    // A red parent is never the root, so grandpa exists.
+    binary_node *grandpa = parent->parent;
+    enum direction dir = (parent == grandpa->child[LEFT]) ? LEFT : RIGHT;
+    enum direction other = (dir == LEFT) ? RIGHT : LEFT;
+    binary_node *uncle = grandpa->child[other];
+
+    if (_rbTree_color(uncle) == RED) {
+      parent->color = BLACK, uncle->color = BLACK, grandpa->color = RED;
+      node = grandpa;
+      continue;
+    }
+    if (node == parent->child[other]) {
+      binary_tree_rotate(tree, parent, dir);
       node = parent;
-      parent = mid;
+      parent = node->parent;
     }
+    binary_tree_rotate(tree, grandpa, other);
+    parent->color = BLACK;
+    grandpa->color = RED;
+    break;
+  }
+  tree->root->color = BLACK;
+}
 
-    if (parent == grandpa->child[LEFT] && node == parent->child[LEFT]) {
-      binary_tree_rotate(tree, grandpa, RIGHT);
-      // At this time, parent on the root, grandpa on the right parent and node
-      // on the parent.
-      parent->color = BLACK;
-      node->color = RED;
-      grandpa->color = RED;
-    } else if (parent == grandpa->child[RIGHT] &&
-               node == parent->child[RIGHT]) {
-      binary_tree_rotate(tree, grandpa, LEFT);
-      parent->color = BLACK;
-      node->color = RED;
-      grandpa->color = RED;
+// Insert the node in one descent. If a node with the same key exists, it is
+// returned and the tree is untouched, otherwise NULL is returned.
+binary_node *rb_tree_insert_or_find(rb_tree *tree, binary_node *node,
+                                    int (*cmp)(const binary_node *,
+                                               const binary_node *)) {
+  assert(node);
+  binary_node *parent = NULL, *curr = tree->root;
+  enum direction dir = LEFT;
+  while (curr) {
+    int c = cmp(curr, node);
+    if (!c) {
+      return curr;
     }
+    parent = curr;
+    dir = (c > 0) ? LEFT : RIGHT;
+    curr = curr->child[dir];
   }
 
-  if (tree->root) {
-    tree->root->color = BLACK;
+  node->parent = parent;
+  _BINARY_LINK_STORE(node->child[LEFT], NULL);
+  _BINARY_LINK_STORE(node->child[RIGHT], NULL);
+  node->color = RED;
+  if (parent == NULL) {
+    _BINARY_LINK_STORE(tree->root, node);
+  } else {
+    _BINARY_LINK_STORE(parent->child[dir], node);
   }
+  _binary_node_pull_size_upward(node);
+  tree->size++;
+  _rbTree_insert_fixup(tree, node);
+  return NULL;
 }
 
 int rb_tree_insert(rb_tree *tree, binary_node *node,
                    int (*cmp)(const binary_node *, const binary_node *)) {
-  int insert_res = bst_insert(tree, node, cmp);
-  if (insert_res) {
-    return insert_res;
-  }
-
-  node->color = RED;
-  _rbTree_set_insert_balance(tree, node);
-  return 0;
+  return rb_tree_insert_or_find(tree, node, cmp) ? -1 : 0;
 }
 
 static inline binary_node *_findSuccessor(binary_node *root) {
@@ -979,32 +1730,27 @@ static inline void _rbTreeRemoveMaintain(rb_tree *tree, binary_node *parent,
   }  // --- 结束修改: while 循环 ---
 }
 
-binary_node *rb_tree_remove(rb_tree *tree, binary_node *node,
-                            int (*cmp)(const binary_node *,
-                                       const binary_node *)) {
-  binary_node *to_remove = _rbTreeFindNode(tree, node, cmp);
-  if (!to_remove) {
-    return NULL;
-  }
-
+// Unlink a node which is in the tree, no compare is needed.
+binary_node *rb_tree_remove_node(rb_tree *tree, binary_node *to_remove) {
   // 4 cases
   tree->size--;
   // Case 0: node is root
   if (to_remove == tree->root && to_remove->child[LEFT] == NULL &&
       to_remove->child[RIGHT] == NULL) {
-    tree->root = NULL;
+    _BINARY_LINK_STORE(tree->root, NULL);
   }
   // Case 1: node is leaf
   else if (!to_remove->child[LEFT] && !to_remove->child[RIGHT]) {
     binary_node *parent = to_remove->parent;
     enum direction dir;
     if (to_remove == parent->child[LEFT]) {
-      parent->child[LEFT] = NULL;
+      _BINARY_LINK_STORE(parent->child[LEFT], NULL);
       dir = LEFT;
     } else if (to_remove == parent->child[RIGHT]) {
-      parent->child[RIGHT] = NULL;
+      _BINARY_LINK_STORE(parent->child[RIGHT], NULL);
       dir = RIGHT;
     }
+    _binary_node_pull_size_upward(parent);
 
     // Black leaf should be processed.
     if (to_remove->color == BLACK) {
@@ -1025,7 +1771,7 @@ binary_node *rb_tree_remove(rb_tree *tree, binary_node *node,
       fixup_dir = (y == fixup_parent->child[LEFT] ? LEFT : RIGHT);
 
       binary_tree_transplant(tree, y, y->child[RIGHT]);
-      y->child[RIGHT] = to_remove->child[RIGHT];
+      _BINARY_LINK_STORE(y->child[RIGHT], to_remove->child[RIGHT]);
       if (y->child[RIGHT]) y->child[RIGHT]->parent = y;
     } else {
       // y 是 to_remove 的直接子节点
@@ -1034,9 +1780,10 @@ binary_node *rb_tree_remove(rb_tree *tree, binary_node *node,
     }
 
     binary_tree_transplant(tree, to_remove, y);
-    y->child[LEFT] = to_remove->child[LEFT];
+    _BINARY_LINK_STORE(y->child[LEFT], to_remove->child[LEFT]);
     if (y->child[LEFT]) y->child[LEFT]->parent = y;
     y->color = to_remove->color;
+    _binary_node_pull_size_upward(fixup_parent);
 
     if (y_original_color == BLACK) {
       // 使用预先保存的安全的父节点和方向进行修复
@@ -1049,7 +1796,8 @@ binary_node *rb_tree_remove(rb_tree *tree, binary_node *node,
     binary_node *child = to_remove->child[LEFT];
     binary_tree_transplant(tree, to_remove, child);
     child->color = BLACK;
-    to_remove->child[LEFT] = NULL;
+    _binary_node_pull_size_upward(child->parent);
+    _BINARY_LINK_STORE(to_remove->child[LEFT], NULL);
   }
   // Case 4: node has child on the right
   else if (to_remove->child[RIGHT]) {
@@ -1058,13 +1806,1361 @@ binary_node *rb_tree_remove(rb_tree *tree, binary_node *node,
     binary_tree_transplant(tree, to_remove, child);
     assert(child->color == RED);
     child->color = BLACK;
-    to_remove->child[RIGHT] = NULL;
+    _binary_node_pull_size_upward(child->parent);
+    _BINARY_LINK_STORE(to_remove->child[RIGHT], NULL);
   }
   if (tree->root) {
     tree->root->color = BLACK;
   }
   to_remove->parent = NULL;
-  to_remove->child[LEFT] = NULL;
-  to_remove->child[RIGHT] = NULL;
+  _BINARY_LINK_STORE(to_remove->child[LEFT], NULL);
+  _BINARY_LINK_STORE(to_remove->child[RIGHT], NULL);
   return to_remove;
 }
+
+// Find the node with the key in one descent and unlink it.
+binary_node *rb_tree_remove_by_key(rb_tree *tree, const binary_node *key,
+                                   int (*cmp)(const binary_node *,
+                                              const binary_node *)) {
+  binary_node *curr = tree->root;
+  while (curr) {
+    int c = cmp(curr, key);
+    if (!c) {
+      return rb_tree_remove_node(tree, curr);
+    }
+    curr = curr->child[(c > 0) ? LEFT : RIGHT];
+  }
+  return NULL;
+}
+
+binary_node *rb_tree_remove(rb_tree *tree, binary_node *node,
+                            int (*cmp)(const binary_node *,
+                                       const binary_node *)) {
+  return rb_tree_remove_by_key(tree, node, cmp);
+}
+
+// Priority queue helpers, pop the smallest or the greatest node.
+binary_node *rb_tree_pop_first(rb_tree *tree) {
+  binary_node *node = bst_get_smallest(tree);
+  return node ? rb_tree_remove_node(tree, node) : NULL;
+}
+
+binary_node *rb_tree_pop_last(rb_tree *tree) {
+  binary_node *node = bst_get_greatest(tree);
+  return node ? rb_tree_remove_node(tree, node) : NULL;
+}
+
+// Bulk building.
+// Link the nodes in [begin, end) as a perfectly balanced subtree. Every node
+// on the deepest level, which is the only one that may be incomplete, is
+// painted red, the others black, so the black height of all the paths is the
+// same.
+static binary_node *_rbTree_build_range(binary_node **nodes, size_t begin,
+                                        size_t end, size_t depth,
+                                        size_t red_depth) {
+  if (begin >= end) {
+    return NULL;
+  }
+  size_t mid = begin + (end - begin) / 2;
+  binary_node *root = nodes[mid];
+  root->child[LEFT] =
+      _rbTree_build_range(nodes, begin, mid, depth + 1, red_depth);
+  root->child[RIGHT] =
+      _rbTree_build_range(nodes, mid + 1, end, depth + 1, red_depth);
+  if (root->child[LEFT]) {
+    root->child[LEFT]->parent = root;
+  }
+  if (root->child[RIGHT]) {
+    root->child[RIGHT]->parent = root;
+  }
+  root->color = (depth == red_depth) ? RED : BLACK;
+  _binary_node_pull_size(root);
+  return root;
+}
+
+// Notice: the nodes must be sorted in strictly ascending order, and the tree
+// should be empty, the old nodes will not be released.
+int rb_tree_build_sorted(rb_tree *tree, binary_node **nodes, size_t n) {
+  if (tree == NULL || (nodes == NULL && n)) {
+    return -1;
+  }
+  // The deepest level of a balanced tree with n nodes is floor(log2(n)).
+  size_t red_depth = 0;
+  while (((size_t)2 << red_depth) <= n) {
+    red_depth++;
+  }
+  tree->root = _rbTree_build_range(nodes, 0, n, 0, red_depth);
+  if (tree->root) {
+    tree->root->parent = NULL;
+    tree->root->color = BLACK;
+  }
+  tree->size = n;
+  return 0;
+}
+
+static binary_node **_rbTree_flatten(binary_node *root, binary_node **out) {
+  if (root == NULL) {
+    return out;
+  }
+  out = _rbTree_flatten(root->child[LEFT], out);
+  *out++ = root;
+  return _rbTree_flatten(root->child[RIGHT], out);
+}
+
+// Move all the nodes of other into tree in O(n + m). The nodes of other whose
+// key already exists in tree are left in other (rebuilt as a valid rb tree),
+// so that the caller can release them.
+int rb_tree_merge(rb_tree *tree, rb_tree *other,
+                  int (*cmp)(const binary_node *, const binary_node *)) {
+  if (tree == NULL || other == NULL) {
+    return -1;
+  }
+  if (tree == other || other->size == 0) {
+    return 0;
+  }
+  size_t n = tree->size, m = other->size;
+  binary_node **buf =
+      (binary_node **)malloc((n + m + n + m) * sizeof(binary_node *));
+#ifdef __GNUC__
+  if (unlikely(!buf)) {
+#else
+  if (!buf) {
+#endif
+    return -1;
+  }
+  binary_node **a = buf, **b = buf + n, **merged = buf + n + m;
+  _rbTree_flatten(tree->root, a);
+  _rbTree_flatten(other->root, b);
+
+  // Duplicates are collected in place at the front of b, which is safe for
+  // they are always written behind the read position.
+  size_t i = 0, j = 0, k = 0, dup = 0;
+  while (i < n && j < m) {
+    int c = cmp(a[i], b[j]);
+    if (c < 0) {
+      merged[k++] = a[i++];
+    } else if (c > 0) {
+      merged[k++] = b[j++];
+    } else {
+      b[dup++] = b[j++];
+    }
+  }
+  while (i < n) {
+    merged[k++] = a[i++];
+  }
+  while (j < m) {
+    merged[k++] = b[j++];
+  }
+
+  rb_tree_build_sorted(tree, merged, k);
+  rb_tree_build_sorted(other, b, dup);
+  free(buf);
+  return 0;
+}
+
+#ifdef ENABLE_ORDER_STATISTIC
+
+// Order statistic.
+// All of these run in O(log n) with the subtree sizes, ranks start from 0.
+
+// The number of keys which are less than the key of node.
+size_t rb_tree_rank(rb_tree *tree, const binary_node *node,
+                    int (*cmp)(const binary_node *, const binary_node *)) {
+  size_t rank = 0;
+  binary_node *curr = tree->root;
+  while (curr) {
+    int c = cmp(curr, node);
+    if (c < 0) {
+      rank += _binary_node_subtree_size(curr->child[LEFT]) + 1;
+      curr = curr->child[RIGHT];
+    } else if (c > 0) {
+      curr = curr->child[LEFT];
+    } else {
+      rank += _binary_node_subtree_size(curr->child[LEFT]);
+      break;
+    }
+  }
+  return rank;
+}
+
+// The rank of a node which is already in the tree, no compare needed.
+size_t rb_tree_node_rank(const binary_node *node) {
+  size_t rank = _binary_node_subtree_size(node->child[LEFT]);
+  while (node->parent) {
+    if (node == node->parent->child[RIGHT]) {
+      rank += _binary_node_subtree_size(node->parent->child[LEFT]) + 1;
+    }
+    node = node->parent;
+  }
+  return rank;
+}
+
+// The node whose rank is k, NULL if k >= size.
+binary_node *rb_tree_select(rb_tree *tree, size_t k) {
+  binary_node *curr = tree->root;
+  while (curr) {
+    size_t left_size = _binary_node_subtree_size(curr->child[LEFT]);
+    if (k < left_size) {
+      curr = curr->child[LEFT];
+    } else if (k > left_size) {
+      k -= left_size + 1;
+      curr = curr->child[RIGHT];
+    } else {
+      return curr;
+    }
+  }
+  return NULL;
+}
+
+// The number of keys in [low, high).
+size_t rb_tree_count_range(rb_tree *tree, const binary_node *low,
+                           const binary_node *high,
+                           int (*cmp)(const binary_node *,
+                                      const binary_node *)) {
+  if (cmp(low, high) >= 0) {
+    return 0;
+  }
+  return rb_tree_rank(tree, high, cmp) - rb_tree_rank(tree, low, cmp);
+}
+
+#endif
+
+#ifdef ENABLE_CONCURRENT
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+// Concurrent rb tree.
+// One writer at a time (serialized by a mutex) and any number of lock free
+// readers. The writer bumps a sequence counter to odd before it touches the
+// tree and back to even after it, a reader retries its descent if the counter
+// changed under it. A removed node is not released at once but retired with
+// the current epoch, and only released once every reader which might still
+// hold it has left its read side critical section.
+// Notice: the payload a reader compares must not change after the insert.
+
+// One bit of reader_mask for each slot.
+#define CONCURRENT_RB_TREE_MAX_READERS 64
+#define CONCURRENT_RB_TREE_RECLAIM_BATCH 1024
+// The height of an rb tree is at most 2 * log2(n + 1). A descent longer than
+// this has run into a half done rotation and is retried.
+#define CONCURRENT_RB_TREE_MAX_DEPTH 128
+
+typedef struct _concurrent_reader_slot {
+  // 0 when the reader is outside a critical section.
+  _Atomic uint64_t epoch;
+  char pad[64 - sizeof(uint64_t)];
+} _concurrent_reader_slot;
+
+typedef struct _retired_node {
+  binary_node *node;
+  uint64_t epoch;
+} _retired_node;
+
+typedef struct concurrent_rb_tree {
+  rb_tree tree;
+  pthread_mutex_t writer_lock;
+  _Atomic size_t seq;
+  _Atomic uint64_t epoch;
+  // Bit i is set while slot i is taken by a reader.
+  _Atomic uint64_t reader_mask;
+  _concurrent_reader_slot readers[CONCURRENT_RB_TREE_MAX_READERS];
+  // Only touched by the writer.
+  _retired_node *retired;
+  size_t retired_size, retired_capacity;
+  void (*release)(binary_node *);
+} concurrent_rb_tree;
+
+// release is called for every removed node once no reader can see it.
+int init_concurrent_rb_tree(concurrent_rb_tree *tree,
+                            void (*release)(binary_node *)) {
+  init_rb_tree(&tree->tree);
+  if (pthread_mutex_init(&tree->writer_lock, NULL)) {
+    return -1;
+  }
+  atomic_init(&tree->seq, 0);
+  atomic_init(&tree->epoch, 1);
+  atomic_init(&tree->reader_mask, 0);
+  for (size_t i = 0; i < CONCURRENT_RB_TREE_MAX_READERS; i++) {
+    atomic_init(&tree->readers[i].epoch, 0);
+  }
+  tree->retired = NULL;
+  tree->retired_size = 0, tree->retired_capacity = 0;
+  tree->release = release;
+  return 0;
+}
+
+// Every reader thread takes a slot before its first read, -1 if all the slots
+// are taken.
+int concurrent_rb_tree_register_reader(concurrent_rb_tree *tree) {
+  uint64_t mask = atomic_load(&tree->reader_mask);
+  while (true) {
+    if (mask == UINT64_MAX) {
+      return -1;
+    }
+    int slot = __builtin_ctzll(~mask);
+    if (atomic_compare_exchange_weak(&tree->reader_mask, &mask,
+                                     mask | (UINT64_C(1) << slot))) {
+      return slot;
+    }
+  }
+}
+
+// Give the slot back once the reader thread is done with the tree, so that
+// another reader can take it. The slot must be outside read_lock.
+void concurrent_rb_tree_unregister_reader(concurrent_rb_tree *tree,
+                                          int slot) {
+  atomic_store(&tree->readers[slot].epoch, 0);
+  atomic_fetch_and(&tree->reader_mask, ~(UINT64_C(1) << slot));
+}
+
+void concurrent_rb_tree_read_lock(concurrent_rb_tree *tree, int slot) {
+  atomic_store(&tree->readers[slot].epoch, atomic_load(&tree->epoch));
+  // The epoch must be visible before any node of the tree is read.
+  atomic_thread_fence(memory_order_seq_cst);
+}
+
+void concurrent_rb_tree_read_unlock(concurrent_rb_tree *tree, int slot) {
+  atomic_store_explicit(&tree->readers[slot].epoch, 0, memory_order_release);
+}
+
+// Must be called inside read_lock / read_unlock, the node returned stays
+// valid until read_unlock.
+binary_node *concurrent_rb_tree_find(concurrent_rb_tree *tree,
+                                     const binary_node *key,
+                                     int (*cmp)(const binary_node *,
+                                                const binary_node *)) {
+  while (true) {
+    size_t seq = atomic_load_explicit(&tree->seq, memory_order_acquire);
+    if (seq & 1) {
+      // The writer may have been preempted inside the update.
+      sched_yield();
+      continue;
+    }
+    binary_node *it = __atomic_load_n(&tree->tree.root, __ATOMIC_ACQUIRE);
+    size_t depth = 0;
+    while (it && depth < CONCURRENT_RB_TREE_MAX_DEPTH) {
+      int c = cmp(it, key);
+      if (!c) {
+        break;
+      }
+      it = __atomic_load_n(&it->child[(c > 0) ? LEFT : RIGHT],
+                           __ATOMIC_ACQUIRE);
+      depth++;
+    }
+    atomic_thread_fence(memory_order_acquire);
+    if (depth < CONCURRENT_RB_TREE_MAX_DEPTH &&
+        atomic_load_explicit(&tree->seq, memory_order_relaxed) == seq) {
+      return it;
+    }
+  }
+}
+
+// The writer lock must be held around these two.
+static inline void _concurrent_rb_tree_write_begin(concurrent_rb_tree *tree) {
+  atomic_store_explicit(&tree->seq,
+                        atomic_load_explicit(&tree->seq, memory_order_relaxed) +
+                            1,
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+
+static inline void _concurrent_rb_tree_write_end(concurrent_rb_tree *tree) {
+  atomic_store_explicit(&tree->seq,
+                        atomic_load_explicit(&tree->seq, memory_order_relaxed) +
+                            1,
+                        memory_order_release);
+}
+
+int concurrent_rb_tree_insert(concurrent_rb_tree *tree, binary_node *node,
+                              int (*cmp)(const binary_node *,
+                                         const binary_node *)) {
+  pthread_mutex_lock(&tree->writer_lock);
+  _concurrent_rb_tree_write_begin(tree);
+  int res = rb_tree_insert(&tree->tree, node, cmp);
+  _concurrent_rb_tree_write_end(tree);
+  pthread_mutex_unlock(&tree->writer_lock);
+  return res;
+}
+
+// Release the retired nodes which no reader can see any more. Called by the
+// writer.
+static void _concurrent_rb_tree_reclaim(concurrent_rb_tree *tree) {
+  // The unlink must be visible before the reader epochs are read.
+  atomic_thread_fence(memory_order_seq_cst);
+  uint64_t oldest = UINT64_MAX;
+  uint64_t readers = atomic_load(&tree->reader_mask);
+  while (readers) {
+    int i = __builtin_ctzll(readers);
+    uint64_t epoch = atomic_load(&tree->readers[i].epoch);
+    if (epoch && epoch < oldest) {
+      oldest = epoch;
+    }
+    readers &= readers - 1;
+  }
+
+  size_t kept = 0;
+  for (size_t i = 0; i < tree->retired_size; i++) {
+    if (tree->retired[i].epoch < oldest) {
+      tree->release(tree->retired[i].node);
+    } else {
+      tree->retired[kept++] = tree->retired[i];
+    }
+  }
+  tree->retired_size = kept;
+}
+
+// Unlink the node with the key, it is released later by the release function.
+// -1 if the key does not exist, -2 if the retire list can not grow.
+int concurrent_rb_tree_remove(concurrent_rb_tree *tree, const binary_node *key,
+                              int (*cmp)(const binary_node *,
+                                         const binary_node *)) {
+  pthread_mutex_lock(&tree->writer_lock);
+  if (tree->retired_size == tree->retired_capacity) {
+    size_t new_capacity = MAX(tree->retired_capacity * 2, 16);
+    _retired_node *new_retired = (_retired_node *)realloc(
+        tree->retired, new_capacity * sizeof(_retired_node));
+    if (new_retired == NULL) {
+      pthread_mutex_unlock(&tree->writer_lock);
+      return -2;
+    }
+    tree->retired = new_retired;
+    tree->retired_capacity = new_capacity;
+  }
+  _concurrent_rb_tree_write_begin(tree);
+  binary_node *removed = rb_tree_remove_by_key(&tree->tree, key, cmp);
+  _concurrent_rb_tree_write_end(tree);
+  if (removed == NULL) {
+    pthread_mutex_unlock(&tree->writer_lock);
+    return -1;
+  }
+
+  // Readers which enter after this point can not reach the node.
+  tree->retired[tree->retired_size].node = removed;
+  tree->retired[tree->retired_size].epoch = atomic_fetch_add(&tree->epoch, 1);
+  tree->retired_size++;
+  if (tree->retired_size >= CONCURRENT_RB_TREE_RECLAIM_BATCH) {
+    _concurrent_rb_tree_reclaim(tree);
+  }
+  pthread_mutex_unlock(&tree->writer_lock);
+  return 0;
+}
+
+void concurrent_rb_tree_reclaim(concurrent_rb_tree *tree) {
+  pthread_mutex_lock(&tree->writer_lock);
+  _concurrent_rb_tree_reclaim(tree);
+  pthread_mutex_unlock(&tree->writer_lock);
+}
+
+// No reader may be running. The nodes still in the tree are left to the
+// caller, e.g. for DESTROY_BINARY_TREE.
+void destroy_concurrent_rb_tree(concurrent_rb_tree *tree) {
+  for (size_t i = 0; i < tree->retired_size; i++) {
+    tree->release(tree->retired[i].node);
+  }
+  free(tree->retired);
+  tree->retired = NULL;
+  tree->retired_size = 0, tree->retired_capacity = 0;
+  pthread_mutex_destroy(&tree->writer_lock);
+}
+
+#endif
+
+#ifdef ENABLE_SERIALIZE
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Flat on disk image of a binary tree, so that a large tree can be loaded at
+// start up without inserting every node again.
+// A header, then one record per node in the BFS order, the root first. A
+// record holds the indices of the two children (BINARY_TREE_IMAGE_NIL for
+// none), the color and then record_size bytes of payload, written and read
+// by the caller. Records are padded to 8 bytes. Numbers are stored in the
+// byte order of the writer, the magic refuses a file of the other order.
+// The image can be searched in place after binary_tree_image_open, or turned
+// back into intrusive nodes with LOAD_BINARY_TREE_IMAGE.
+
+#define BINARY_TREE_IMAGE_MAGIC 0x31525442u
+#define BINARY_TREE_IMAGE_NIL UINT32_MAX
+
+typedef struct binary_tree_image_header {
+  uint32_t magic;
+  uint32_t record_size;
+  uint32_t stride;
+  uint32_t count;
+} binary_tree_image_header;
+
+typedef struct binary_tree_image_record {
+  uint32_t child[2];
+  uint32_t color;
+  uint32_t reserved;
+  // The payload follows.
+} binary_tree_image_record;
+
+typedef struct binary_tree_image {
+  void *map;
+  size_t length;
+  const binary_tree_image_header *header;
+  const char *records;
+} binary_tree_image;
+
+static inline size_t _binary_tree_image_stride(size_t record_size) {
+  return (sizeof(binary_tree_image_record) + record_size + 7) & ~(size_t)7;
+}
+
+static void _binary_tree_image_count(binary_node *node, void *count) {
+  (void)node;
+  ++*(size_t *)count;
+}
+
+// store copies the payload of a node into the record_size bytes it is given.
+// Returns 0 on success, -1 if the file cannot be written and -2 if the
+// memory cannot be allocated.
+int binary_tree_save(binary_tree *tree, const char *path, size_t record_size,
+                     void (*store)(const binary_node *, void *)) {
+  size_t total = 0, count = 0;
+  binary_node_traverse_ctx(tree->root, _binary_tree_image_count, &total, PRE);
+  binary_node **queue =
+      (binary_node **)malloc(sizeof(binary_node *) * (total ? total : 1));
+#ifdef __GNUC__
+  if (unlikely(queue == NULL)) {
+#else
+  if (queue == NULL) {
+#endif
+    perror("Fail to allocate the queue");
+    return -2;
+  }
+  // The BFS order, queue[i] is the record i.
+  if (tree->root != NULL) {
+    queue[count++] = tree->root;
+  }
+  for (size_t head = 0; head < count; head++) {
+    for (int dir = LEFT; dir <= RIGHT; dir++) {
+      if (queue[head]->child[dir] != NULL) {
+        queue[count++] = queue[head]->child[dir];
+      }
+    }
+  }
+  if (count >= BINARY_TREE_IMAGE_NIL || record_size > UINT32_MAX / 2) {
+    free(queue);
+    return -1;
+  }
+
+  size_t stride = _binary_tree_image_stride(record_size);
+  char *buffer = (char *)calloc(1, stride);
+#ifdef __GNUC__
+  if (unlikely(buffer == NULL)) {
+#else
+  if (buffer == NULL) {
+#endif
+    perror("Fail to allocate the record");
+    free(queue);
+    return -2;
+  }
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    free(buffer);
+    free(queue);
+    return -1;
+  }
+
+  binary_tree_image_header header = {BINARY_TREE_IMAGE_MAGIC,
+                                     (uint32_t)record_size, (uint32_t)stride,
+                                     (uint32_t)count};
+  bool fail = fwrite(&header, sizeof(header), 1, file) != 1;
+  // The children of the record i take the next unused indices, just as they
+  // were put into the queue.
+  uint32_t next = 1;
+  binary_tree_image_record *record = (binary_tree_image_record *)buffer;
+  for (size_t i = 0; i < count && !fail; i++) {
+    for (int dir = LEFT; dir <= RIGHT; dir++) {
+      record->child[dir] =
+          queue[i]->child[dir] ? next++ : BINARY_TREE_IMAGE_NIL;
+    }
+    record->color = queue[i]->color;
+    store(queue[i], buffer + sizeof(binary_tree_image_record));
+    fail = fwrite(buffer, stride, 1, file) != 1;
+  }
+  fail = fclose(file) != 0 || fail;
+
+  free(buffer);
+  free(queue);
+  return fail ? -1 : 0;
+}
+
+// Map the image read only. record_size is the payload size the callbacks of
+// the caller read, the one the image was saved with. Returns 0 on success, -1
+// if the file cannot be opened, is not an image or holds records of another
+// size.
+int binary_tree_image_open(binary_tree_image *image, const char *path,
+                           size_t record_size) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      (size_t)st.st_size < sizeof(binary_tree_image_header)) {
+    close(fd);
+    return -1;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+
+  const binary_tree_image_header *header =
+      (const binary_tree_image_header *)map;
+  if (header->magic != BINARY_TREE_IMAGE_MAGIC ||
+      header->record_size != record_size ||
+      header->stride != _binary_tree_image_stride(header->record_size) ||
+      header->count >= BINARY_TREE_IMAGE_NIL ||
+      (st.st_size - sizeof(*header)) / header->stride < header->count) {
+    munmap(map, st.st_size);
+    return -1;
+  }
+  image->map = map;
+  image->length = st.st_size;
+  image->header = header;
+  image->records = (const char *)map + sizeof(*header);
+  return 0;
+}
+
+void binary_tree_image_close(binary_tree_image *image) {
+  munmap(image->map, image->length);
+  image->map = NULL;
+  image->length = 0;
+  image->header = NULL;
+  image->records = NULL;
+}
+
+size_t binary_tree_image_get_size(const binary_tree_image *image) {
+  return image->header->count;
+}
+
+static inline const binary_tree_image_record *_binary_tree_image_record(
+    const binary_tree_image *image, uint32_t index) {
+  return (const binary_tree_image_record *)(image->records +
+                                            (size_t)index *
+                                                image->header->stride);
+}
+
+// BINARY_TREE_IMAGE_NIL if the image is empty.
+uint32_t binary_tree_image_root(const binary_tree_image *image) {
+  return image->header->count ? 0 : BINARY_TREE_IMAGE_NIL;
+}
+
+uint32_t binary_tree_image_child(const binary_tree_image *image,
+                                 uint32_t index, enum direction dir) {
+  return _binary_tree_image_record(image, index)->child[dir];
+}
+
+enum color binary_tree_image_color(const binary_tree_image *image,
+                                   uint32_t index) {
+  return (enum color)_binary_tree_image_record(image, index)->color;
+}
+
+const void *binary_tree_image_payload(const binary_tree_image *image,
+                                      uint32_t index) {
+  return _binary_tree_image_record(image, index) + 1;
+}
+
+// Search an image of a bst in place. cmp(payload, key) follows the
+// comparators of the bst, a positive result goes to the left. Returns the
+// index of the record or BINARY_TREE_IMAGE_NIL. The records are in the BFS
+// order, so a child always follows its parent. A link that does not is
+// corrupt, the search stops there instead of running in a cycle.
+uint32_t binary_tree_image_find(const binary_tree_image *image,
+                                const void *key,
+                                int (*cmp)(const void *, const void *)) {
+  uint32_t curr = binary_tree_image_root(image);
+  while (curr < image->header->count) {
+    int res = cmp(binary_tree_image_payload(image, curr), key);
+    if (res == 0) {
+      return curr;
+    }
+    uint32_t child =
+        binary_tree_image_child(image, curr, res > 0 ? LEFT : RIGHT);
+    if (child <= curr) {
+      return BINARY_TREE_IMAGE_NIL;
+    }
+    curr = child;
+  }
+  return BINARY_TREE_IMAGE_NIL;
+}
+
+// All the nodes are allocated in one block, which is returned and must be
+// released with free() once the tree is not used any more, never node by
+// node. The nodes lie in the block in the BFS order. load fills the node it
+// is given from the payload. Returns NULL if the memory cannot be allocated
+// or the records do not form a tree in the BFS order.
+void *_binary_tree_image_load(const binary_tree_image *image,
+                              binary_tree *tree, size_t node_size,
+                              size_t offset,
+                              void (*load)(binary_node *, const void *)) {
+  size_t count = image->header->count;
+  char *block = (char *)malloc(node_size * (count ? count : 1));
+#ifdef __GNUC__
+  if (unlikely(block == NULL)) {
+#else
+  if (block == NULL) {
+#endif
+    perror("Fail to allocate the nodes");
+    return NULL;
+  }
+
+#define _IMAGE_NODE(INDEX) \
+  ((binary_node *)(block + (INDEX) * node_size + offset))
+  uint32_t next = 1;
+  for (size_t i = 0; i < count; i++) {
+    const binary_tree_image_record *record =
+        _binary_tree_image_record(image, i);
+    binary_node *node = _IMAGE_NODE(i);
+    if (i == 0) {
+      node->parent = NULL;
+    }
+    for (int dir = LEFT; dir <= RIGHT; dir++) {
+      if (record->child[dir] == BINARY_TREE_IMAGE_NIL) {
+        node->child[dir] = NULL;
+        continue;
+      }
+      if (record->child[dir] != next || next >= count) {
+        free(block);
+        return NULL;
+      }
+      node->child[dir] = _IMAGE_NODE(next);
+      node->child[dir]->parent = node;
+      next++;
+    }
+    node->color = (enum color)record->color;
+    load(node, record + 1);
+  }
+  if (next != (count ? count : 1)) {
+    free(block);
+    return NULL;
+  }
+  // Children come after their parent.
+  for (size_t i = count; i-- > 0;) {
+    _binary_node_pull_size(_IMAGE_NODE(i));
+  }
+  tree->root = count ? _IMAGE_NODE(0) : NULL;
+  tree->size = count;
+#undef _IMAGE_NODE
+  return block;
+}
+
+#define LOAD_BINARY_TREE_IMAGE(NODE_TYPE, MEMBER, TREE_PTR, IMAGE_PTR, LOAD) \
+  ((NODE_TYPE *)_binary_tree_image_load(IMAGE_PTR, TREE_PTR,                 \
+                                        sizeof(NODE_TYPE),                   \
+                                        offsetof(NODE_TYPE, MEMBER), LOAD))
+
+#endif
+
+// Test code, node pool against malloc on 10M remove / insert cycles.
+// #include <time.h>
+//
+// typedef struct int_node {
+//   int key;
+//   binary_node node;
+// } int_node;
+//
+// int int_node_cmp(const binary_node *a, const binary_node *b) {
+//   int x = CONTAINER_OF(int_node, node, a)->key,
+//       y = CONTAINER_OF(int_node, node, b)->key;
+//   return (x > y) - (x < y);
+// }
+//
+// int main() {
+//   enum { LIVE = 1024, CYCLES = 10000000 };
+//   rb_tree tree;
+//   binary_node *live[LIVE];
+//   clock_t begin;
+//
+//   init_rb_tree(&tree);
+//   begin = clock();
+//   for (int i = 0; i < LIVE; i++) {
+//     live[i] = MAKE_BINARY_NODE(int_node, node);
+//     CONTAINER_OF(int_node, node, live[i])->key = i;
+//     rb_tree_insert(&tree, live[i], int_node_cmp);
+//   }
+//   for (int i = 0; i < CYCLES; i++) {
+//     int slot = i % LIVE;
+//     rb_tree_remove(&tree, live[slot], int_node_cmp);
+//     FREE_BINARY_NODE(int_node, node, live[slot]);
+//     live[slot] = MAKE_BINARY_NODE(int_node, node);
+//     CONTAINER_OF(int_node, node, live[slot])->key = LIVE + i;
+//     rb_tree_insert(&tree, live[slot], int_node_cmp);
+//   }
+//   DESTROY_BINARY_TREE(int_node, node, &tree);
+//   printf("malloc: %.3fs\n", (double)(clock() - begin) / CLOCKS_PER_SEC);
+//
+//   binary_node_pool pool;
+//   INIT_BINARY_NODE_POOL(int_node, node, &pool);
+//   init_rb_tree(&tree);
+//   begin = clock();
+//   for (int i = 0; i < LIVE; i++) {
+//     live[i] = MAKE_BINARY_NODE_IN_POOL(int_node, node, &pool);
+//     CONTAINER_OF(int_node, node, live[i])->key = i;
+//     rb_tree_insert(&tree, live[i], int_node_cmp);
+//   }
+//   for (int i = 0; i < CYCLES; i++) {
+//     int slot = i % LIVE;
+//     rb_tree_remove(&tree, live[slot], int_node_cmp);
+//     FREE_BINARY_NODE_IN_POOL(int_node, node, &pool, live[slot]);
+//     live[slot] = MAKE_BINARY_NODE_IN_POOL(int_node, node, &pool);
+//     CONTAINER_OF(int_node, node, live[slot])->key = LIVE + i;
+//     rb_tree_insert(&tree, live[slot], int_node_cmp);
+//   }
+//   DESTROY_BINARY_TREE_IN_POOL(int_node, node, &tree, &pool);
+//   assert(binary_node_pool_in_use(&pool) == 0);
+//   destroy_binary_node_pool(&pool);
+//   printf("pool:   %.3fs\n", (double)(clock() - begin) / CLOCKS_PER_SEC);
+// }
+
+// Test code, bulk building against n inserts of sorted keys.
+// int_node and int_node_cmp are the same as in the node pool test above.
+//
+// int main() {
+//   enum { N = 10000000 };
+//   int_node *pool = (int_node *)malloc(N * sizeof(int_node));
+//   binary_node **nodes = (binary_node **)malloc(N * sizeof(binary_node *));
+//   rb_tree tree;
+//   clock_t begin;
+//
+//   for (int i = 0; i < N; i++) {
+//     pool[i].key = i;
+//     nodes[i] = &pool[i].node;
+//   }
+//
+//   init_rb_tree(&tree);
+//   begin = clock();
+//   for (int i = 0; i < N; i++) {
+//     rb_tree_insert(&tree, nodes[i], int_node_cmp);
+//   }
+//   printf("insert: %.3fs\n", (double)(clock() - begin) / CLOCKS_PER_SEC);
+//
+//   init_rb_tree(&tree);
+//   begin = clock();
+//   rb_tree_build_sorted(&tree, nodes, N);
+//   printf("build:  %.3fs\n", (double)(clock() - begin) / CLOCKS_PER_SEC);
+//   free(nodes);
+//   free(pool);
+// }
+
+// Test code, full in order scan: recursion, parent links with ctx and cursor.
+// int_node is the same as in the node pool test above.
+//
+// static long long scan_sum;
+//
+// void sum_node(binary_node *node) {
+//   scan_sum += CONTAINER_OF(int_node, node, node)->key;
+// }
+//
+// void sum_node_ctx(binary_node *node, void *ctx) {
+//   *(long long *)ctx += CONTAINER_OF(int_node, node, node)->key;
+// }
+//
+// int main() {
+//   enum { N = 10000000 };
+//   int_node *pool = (int_node *)malloc(N * sizeof(int_node));
+//   binary_node **nodes = (binary_node **)malloc(N * sizeof(binary_node *));
+//   rb_tree tree;
+//   clock_t begin;
+//   long long sum = 0;
+//
+//   for (int i = 0; i < N; i++) {
+//     pool[i].key = i;
+//     nodes[i] = &pool[i].node;
+//   }
+//   init_rb_tree(&tree);
+//   rb_tree_build_sorted(&tree, nodes, N);
+//
+//   begin = clock();
+//   binary_tree_traverse(&tree, sum_node, IN);
+//   printf("recursive: %.3fs %lld\n", (double)(clock() - begin) / CLOCKS_PER_SEC,
+//          scan_sum);
+//
+//   begin = clock();
+//   binary_tree_traverse_ctx(&tree, sum_node_ctx, &sum, IN);
+//   printf("ctx:       %.3fs %lld\n", (double)(clock() - begin) / CLOCKS_PER_SEC,
+//          sum);
+//
+//   sum = 0;
+//   begin = clock();
+//   for (bst_node *it = bst_first(&tree); it; it = bst_next(it)) {
+//     sum += CONTAINER_OF(int_node, node, it)->key;
+//   }
+//   printf("cursor:    %.3fs %lld\n", (double)(clock() - begin) / CLOCKS_PER_SEC,
+//          sum);
+//   free(nodes);
+//   free(pool);
+// }
+
+// Test code, order statistic, compile with -DENABLE_ORDER_STATISTIC.
+// int_node and int_node_cmp are the same as in the node pool test above.
+//
+// int main() {
+//   rb_tree tree;
+//   init_rb_tree(&tree);
+//   for (int i = 0; i < 100; i++) {
+//     binary_node *node = MAKE_BINARY_NODE(int_node, node);
+//     CONTAINER_OF(int_node, node, node)->key = (i * 37) % 100;
+//     rb_tree_insert(&tree, node, int_node_cmp);
+//   }
+//   for (int i = 0; i < 100; i += 3) {
+//     int_node key = {.key = i};
+//     free(CONTAINER_OF(int_node, node,
+//                       rb_tree_remove(&tree, &key.node, int_node_cmp)));
+//   }
+//
+//   int_node low = {.key = 10}, high = {.key = 20};
+//   // 10 ~ 19 without 12, 15 and 18.
+//   assert(rb_tree_count_range(&tree, &low.node, &high.node, int_node_cmp) ==
+//          7);
+//   // 0, 3, 6 and 9 are removed.
+//   assert(rb_tree_rank(&tree, &low.node, int_node_cmp) == 6);
+//   assert(CONTAINER_OF(int_node, node, rb_tree_select(&tree, 6))->key == 10);
+//   assert(rb_tree_node_rank(rb_tree_select(&tree, 42)) == 42);
+//   DESTROY_BINARY_TREE(int_node, node, &tree);
+// }
+
+// Test code, compare counts of the fused insert and the priority queue pop.
+// int_node is the same as in the node pool test above.
+//
+// static size_t compare_count;
+//
+// int int_node_cmp(const binary_node *a, const binary_node *b) {
+//   int x = CONTAINER_OF(int_node, node, a)->key,
+//       y = CONTAINER_OF(int_node, node, b)->key;
+//   compare_count++;
+//   return (x > y) - (x < y);
+// }
+//
+// int main() {
+//   enum { N = 1000000, OPS = 10000000 };
+//   int_node *pool = (int_node *)malloc(N * sizeof(int_node));
+//   rb_tree tree;
+//   unsigned x = 1;
+//   clock_t begin;
+//
+//   init_rb_tree(&tree);
+//   for (int i = 0; i < N; i++) {
+//     x = x * 1103515245 + 12345;
+//     pool[i].key = (int)(x >> 1);
+//   }
+//   compare_count = 0;
+//   begin = clock();
+//   for (int i = 0; i < N; i++) {
+//     rb_tree_insert_or_find(&tree, &pool[i].node, int_node_cmp);
+//   }
+//   printf("insert: %.1f cmp/op, %.1f ns/op\n", (double)compare_count / N,
+//          (double)(clock() - begin) * 1e9 / CLOCKS_PER_SEC / N);
+//
+//   // Pop the smallest and push it back with a greater key.
+//   compare_count = 0;
+//   begin = clock();
+//   for (int i = 0; i < OPS; i++) {
+//     binary_node *it = rb_tree_pop_first(&tree);
+//     CONTAINER_OF(int_node, node, it)->key += 1 << 20;
+//     while (rb_tree_insert_or_find(&tree, it, int_node_cmp)) {
+//       CONTAINER_OF(int_node, node, it)->key++;
+//     }
+//   }
+//   printf("pq:     %.1f cmp/op, %.1f ns/op\n", (double)compare_count / OPS,
+//          (double)(clock() - begin) * 1e9 / CLOCKS_PER_SEC / OPS);
+//   free(pool);
+// }
+
+// Test code, reader scaling with one writer, compile with -DENABLE_CONCURRENT
+// -pthread.
+// #include <time.h>
+//
+// typedef struct int_node {
+//   int key;
+//   binary_node node;
+// } int_node;
+//
+// int int_node_cmp(const binary_node *a, const binary_node *b) {
+//   int x = CONTAINER_OF(int_node, node, a)->key,
+//       y = CONTAINER_OF(int_node, node, b)->key;
+//   return (x > y) - (x < y);
+// }
+//
+// void int_node_release(binary_node *node) {
+//   FREE_BINARY_NODE(int_node, node, node);
+// }
+//
+// enum { KEYS = 1 << 20, SECONDS = 2 };
+// static concurrent_rb_tree shared;
+// static atomic_bool running;
+//
+// void *reader(void *arg) {
+//   int slot = concurrent_rb_tree_register_reader(&shared);
+//   unsigned x = (unsigned)(uintptr_t)arg + 1;
+//   size_t reads = 0;
+//   assert(slot >= 0);
+//   while (atomic_load_explicit(&running, memory_order_relaxed)) {
+//     int_node key;
+//     x = x * 1103515245 + 12345;
+//     key.key = (int)(x % KEYS);
+//     concurrent_rb_tree_read_lock(&shared, slot);
+//     binary_node *found = concurrent_rb_tree_find(&shared, &key.node,
+//                                                  int_node_cmp);
+//     assert(!found || CONTAINER_OF(int_node, node, found)->key == key.key);
+//     concurrent_rb_tree_read_unlock(&shared, slot);
+//     reads++;
+//   }
+//   concurrent_rb_tree_unregister_reader(&shared, slot);
+//   return (void *)reads;
+// }
+//
+// void *writer(void *arg) {
+//   unsigned x = 42;
+//   size_t writes = 0;
+//   (void)arg;
+//   while (atomic_load_explicit(&running, memory_order_relaxed)) {
+//     int_node key;
+//     x = x * 1103515245 + 12345;
+//     key.key = (int)(x % KEYS);
+//     if (concurrent_rb_tree_remove(&shared, &key.node, int_node_cmp)) {
+//       binary_node *node = MAKE_BINARY_NODE(int_node, node);
+//       CONTAINER_OF(int_node, node, node)->key = key.key;
+//       concurrent_rb_tree_insert(&shared, node, int_node_cmp);
+//     }
+//     writes++;
+//   }
+//   return (void *)writes;
+// }
+//
+// int main() {
+//   init_concurrent_rb_tree(&shared, int_node_release);
+//   for (int i = 0; i < KEYS; i += 2) {
+//     binary_node *node = MAKE_BINARY_NODE(int_node, node);
+//     CONTAINER_OF(int_node, node, node)->key = i;
+//     concurrent_rb_tree_insert(&shared, node, int_node_cmp);
+//   }
+//
+//   for (int threads = 1; threads <= 16; threads *= 2) {
+//     pthread_t readers[16], w;
+//     size_t reads = 0;
+//     void *res;
+//     atomic_store(&running, true);
+//     for (int i = 0; i < threads; i++) {
+//       pthread_create(&readers[i], NULL, reader, (void *)(uintptr_t)i);
+//     }
+//     pthread_create(&w, NULL, writer, NULL);
+//     struct timespec duration = {SECONDS, 0};
+//     nanosleep(&duration, NULL);
+//     atomic_store(&running, false);
+//     for (int i = 0; i < threads; i++) {
+//       pthread_join(readers[i], &res);
+//       reads += (size_t)res;
+//     }
+//     pthread_join(w, &res);
+//     printf("%2d readers: %.2f M reads/s, %.2f M writes/s\n", threads,
+//            reads / 1e6 / SECONDS, (size_t)res / 1e6 / SECONDS);
+//   }
+//
+//   concurrent_rb_tree_reclaim(&shared);
+//   DESTROY_BINARY_TREE(int_node, node, &shared.tree);
+//   destroy_concurrent_rb_tree(&shared);
+// }
+
+// Test code, LCA walk against the LCA index on a balanced tree of 1M nodes.
+// int_node is the same as in the node pool test above.
+//
+// int main() {
+//   enum { N = 1000000, QUERIES = 10000000, NAIVE_QUERIES = 100 };
+//   int_node *pool = (int_node *)malloc(N * sizeof(int_node));
+//   binary_node **nodes = (binary_node **)malloc(N * sizeof(binary_node *));
+//   binary_node **first = (binary_node **)malloc(QUERIES * sizeof(binary_node *));
+//   binary_node **second =
+//       (binary_node **)malloc(QUERIES * sizeof(binary_node *));
+//   binary_node **res = (binary_node **)malloc(QUERIES * sizeof(binary_node *));
+//   binary_tree_lca_index index;
+//   rb_tree tree;
+//   clock_t begin;
+//   unsigned x = 1;
+//
+//   for (int i = 0; i < N; i++) {
+//     pool[i].key = i;
+//     nodes[i] = &pool[i].node;
+//   }
+//   init_rb_tree(&tree);
+//   rb_tree_build_sorted(&tree, nodes, N);
+//   for (int i = 0; i < QUERIES; i++) {
+//     x = x * 1103515245 + 12345;
+//     first[i] = nodes[(x >> 8) % N];
+//     x = x * 1103515245 + 12345;
+//     second[i] = nodes[(x >> 8) % N];
+//   }
+//
+//   begin = clock();
+//   for (int i = 0; i < NAIVE_QUERIES; i++) {
+//     res[i] = binary_tree_find_lowest_ancestor(&tree, first[i], second[i]);
+//   }
+//   printf("walk:  %.1f us/query\n", (double)(clock() - begin) * 1e6 /
+//                                        CLOCKS_PER_SEC / NAIVE_QUERIES);
+//
+//   begin = clock();
+//   binary_tree_build_lca_index(&tree, &index);
+//   printf("build: %.3fs\n", (double)(clock() - begin) / CLOCKS_PER_SEC);
+//   begin = clock();
+//   binary_tree_lca_query_batch(&index, first, second, res, QUERIES);
+//   printf("index: %.1f ns/query\n",
+//          (double)(clock() - begin) * 1e9 / CLOCKS_PER_SEC / QUERIES);
+//   for (int i = 0; i < NAIVE_QUERIES; i++) {
+//     assert(res[i] ==
+//            binary_node_find_lowest_ancestor(tree.root, first[i], second[i]));
+//   }
+//
+//   destroy_binary_tree_lca_index(&index);
+//   free(res);
+//   free(second);
+//   free(first);
+//   free(nodes);
+//   free(pool);
+// }
+
+// Test code, construct_binary_tree from PRE and POST order on a balanced tree
+// and on a left chain of 1M nodes. The chain used to cost a linear scan per
+// level and 1M levels of recursion.
+// int_node is the same as in the node pool test above.
+//
+// struct collect_ctx {
+//   binary_node **list;
+//   size_t pos;
+// };
+//
+// void collect(binary_node *node, void *ctx) {
+//   struct collect_ctx *c = (struct collect_ctx *)ctx;
+//   c->list[c->pos++] = node;
+// }
+//
+// int main() {
+//   enum { N = 1000000 };
+//   int_node *pool = (int_node *)malloc(N * sizeof(int_node));
+//   binary_node **mid = (binary_node **)malloc(N * sizeof(binary_node *));
+//   binary_node **pre = (binary_node **)malloc(N * sizeof(binary_node *));
+//   binary_node **post = (binary_node **)malloc(N * sizeof(binary_node *));
+//   rb_tree tree;
+//   clock_t begin;
+//
+//   for (int shape = 0; shape < 2; shape++) {
+//     for (int i = 0; i < N; i++) {
+//       pool[i].key = i;
+//       mid[i] = &pool[i].node;
+//     }
+//     init_rb_tree(&tree);
+//     if (shape == 0) {
+//       rb_tree_build_sorted(&tree, mid, N);
+//     } else {
+//       // Left chain, the root is the greatest node.
+//       for (int i = 0; i < N; i++) {
+//         pool[i].node.parent = i + 1 < N ? &pool[i + 1].node : NULL;
+//         pool[i].node.child[LEFT] = i > 0 ? &pool[i - 1].node : NULL;
+//         pool[i].node.child[RIGHT] = NULL;
+//       }
+//       tree.root = &pool[N - 1].node;
+//     }
+//     // The stackless traversal, a recursive walk would overflow on the chain.
+//     struct collect_ctx ctx = {pre, 0};
+//     binary_node_traverse_ctx(tree.root, collect, &ctx, PRE);
+//     ctx = (struct collect_ctx){post, 0};
+//     binary_node_traverse_ctx(tree.root, collect, &ctx, POST);
+//
+//     begin = clock();
+//     assert(construct_binary_tree(mid, pre, N, PRE) == tree.root);
+//     printf("%s PRE:  %.3fs\n", shape == 0 ? "balanced" : "chain",
+//            (double)(clock() - begin) / CLOCKS_PER_SEC);
+//     begin = clock();
+//     assert(construct_binary_tree(mid, post, N, POST) == tree.root);
+//     printf("%s POST: %.3fs\n", shape == 0 ? "balanced" : "chain",
+//            (double)(clock() - begin) / CLOCKS_PER_SEC);
+//   }
+//
+//   free(post);
+//   free(pre);
+//   free(mid);
+//   free(pool);
+// }
+
+// Test code, 1M random keys, inserted one by one against loaded from the
+// image. Build with ENABLE_SERIALIZE.
+// int_node is the same as in the node pool test above.
+//
+// void store_key(const binary_node *node, void *payload) {
+//   *(int *)payload = CONTAINER_OF(int_node, node, node)->key;
+// }
+//
+// void load_key(binary_node *node, const void *payload) {
+//   CONTAINER_OF(int_node, node, node)->key = *(const int *)payload;
+// }
+//
+// int cmp_payload(const void *payload, const void *key) {
+//   return *(const int *)payload - *(const int *)key;
+// }
+//
+// bool same_tree(binary_node *a, binary_node *b) {
+//   if (a == NULL || b == NULL) {
+//     return a == b;
+//   }
+//   return CONTAINER_OF(int_node, node, a)->key ==
+//              CONTAINER_OF(int_node, node, b)->key &&
+//          a->color == b->color && same_tree(a->child[LEFT], b->child[LEFT]) &&
+//          same_tree(a->child[RIGHT], b->child[RIGHT]);
+// }
+//
+// int main() {
+//   enum { N = 1000000 };
+//   rb_tree tree, loaded;
+//   binary_tree_image image;
+//   clock_t begin;
+//   unsigned x = 1;
+//
+//   init_rb_tree(&tree);
+//   begin = clock();
+//   for (int i = 0; i < N; i++) {
+//     x = x * 1103515245 + 12345;
+//     binary_node *node = MAKE_BINARY_NODE(int_node, node);
+//     CONTAINER_OF(int_node, node, node)->key = (int)(x >> 1);
+//     if (rb_tree_insert(&tree, node, int_node_cmp)) {
+//       FREE_BINARY_NODE(int_node, node, node);
+//     }
+//   }
+//   printf("insert: %.3fs\n", (double)(clock() - begin) / CLOCKS_PER_SEC);
+//
+//   assert(binary_tree_save(&tree, "tree.img", sizeof(int), store_key) == 0);
+//   begin = clock();
+//   assert(binary_tree_image_open(&image, "tree.img", sizeof(int) + 1) == -1);
+//   assert(binary_tree_image_open(&image, "tree.img", sizeof(int)) == 0);
+//   int_node *block =
+//       LOAD_BINARY_TREE_IMAGE(int_node, node, &loaded, &image, load_key);
+//   printf("load:   %.3fs\n", (double)(clock() - begin) / CLOCKS_PER_SEC);
+//
+//   assert(block != NULL && loaded.size == tree.size);
+//   assert(same_tree(tree.root, loaded.root));
+//   int key = CONTAINER_OF(int_node, node, tree.root)->key;
+//   assert(binary_tree_image_find(&image, &key, cmp_payload) == 0);
+//
+//   binary_tree_image_close(&image);
+//   free(block);
+//   DESTROY_BINARY_TREE(int_node, node, &tree);
+// }
+
+// Test code, paging through 50M keys 100 at a time, once by keeping the
+// cursor and once by seeking again after the last key of every page, as a
+// stateless reader would do.
+// int_node is the same as in the node pool test above.
+//
+// int main() {
+//   enum { N = 50000000, PAGE = 100 };
+//   int_node *pool = (int_node *)malloc(N * sizeof(int_node));
+//   binary_node **nodes = (binary_node **)malloc(N * sizeof(binary_node *));
+//   binary_node *page[PAGE];
+//   bst_range_cursor cursor;
+//   rb_tree tree;
+//   clock_t begin;
+//   size_t got, total;
+//   long long sum;
+//
+//   for (int i = 0; i < N; i++) {
+//     pool[i].key = i;
+//     nodes[i] = &pool[i].node;
+//   }
+//   init_rb_tree(&tree);
+//   rb_tree_build_sorted(&tree, nodes, N);
+//   free(nodes);
+//
+//   for (enum direction dir = LEFT; dir <= RIGHT; dir++) {
+//     begin = clock();
+//     total = 0, sum = 0;
+//     bst_range_cursor_seek(&cursor, &tree, NULL, int_node_cmp, dir, true);
+//     do {
+//       got = bst_range_cursor_read(&cursor, page, PAGE);
+//       for (size_t i = 0; i < got; i++) {
+//         sum += CONTAINER_OF(int_node, node, page[i])->key;
+//       }
+//       total += got;
+//     } while (got == PAGE);
+//     assert(total == N && sum == (long long)N * (N - 1) / 2);
+//     printf("%s, kept:    %.3fs\n", dir == RIGHT ? "asc" : "desc",
+//            (double)(clock() - begin) / CLOCKS_PER_SEC);
+//
+//     begin = clock();
+//     total = 0;
+//     bst_range_cursor_seek(&cursor, &tree, NULL, int_node_cmp, dir, true);
+//     while ((got = bst_range_cursor_read(&cursor, page, PAGE)) == PAGE) {
+//       total += got;
+//       bst_range_cursor_seek(&cursor, &tree, page[PAGE - 1], int_node_cmp,
+//                             dir, false);
+//     }
+//     assert(total + got == N);
+//     printf("%s, re-seek: %.3fs\n", dir == RIGHT ? "asc" : "desc",
+//            (double)(clock() - begin) / CLOCKS_PER_SEC);
+//   }
+//
+//   free(pool);
+// }
+
+// Test code, 4M random probes on a tree of 4M keys, one descent per probe
+// against the batch queries.
+// int_node is the same as in the node pool test above.
+//
+// int main() {
+//   enum { N = 4000000, M = 4000000 };
+//   int_node *pool = (int_node *)malloc(N * sizeof(int_node));
+//   int_node *probes = (int_node *)malloc(M * sizeof(int_node));
+//   binary_node **nodes = (binary_node **)malloc(N * sizeof(binary_node *));
+//   const binary_node **keys =
+//       (const binary_node **)malloc(M * sizeof(binary_node *));
+//   binary_node **res = (binary_node **)malloc(M * sizeof(binary_node *));
+//   size_t *levels = (size_t *)malloc(M * sizeof(size_t));
+//   rb_tree tree;
+//   clock_t begin;
+//   unsigned x = 1;
+//
+//   for (int i = 0; i < N; i++) {
+//     pool[i].key = 2 * i;
+//     nodes[i] = &pool[i].node;
+//   }
+//   init_rb_tree(&tree);
+//   rb_tree_build_sorted(&tree, nodes, N);
+//   for (int i = 0; i < M; i++) {
+//     x = x * 1103515245 + 12345;
+//     probes[i].key = (int)((x >> 1) % (2 * N));
+//     keys[i] = &probes[i].node;
+//   }
+//
+//   begin = clock();
+//   for (int i = 0; i < M; i++) {
+//     res[i] = bst_seek(&tree, keys[i], int_node_cmp, RIGHT, false);
+//   }
+//   printf("single: %.1f M/s\n",
+//          M / 1e6 / ((double)(clock() - begin) / CLOCKS_PER_SEC));
+//   begin = clock();
+//   bst_batch_seek(&tree, keys, M, int_node_cmp, RIGHT, false, res);
+//   printf("batch:  %.1f M/s\n",
+//          M / 1e6 / ((double)(clock() - begin) / CLOCKS_PER_SEC));
+//   begin = clock();
+//   bst_batch_level(&tree, keys, M, int_node_cmp, levels);
+//   printf("level:  %.1f M/s\n",
+//          M / 1e6 / ((double)(clock() - begin) / CLOCKS_PER_SEC));
+//   for (int i = 0; i < M; i++) {
+//     int key = probes[i].key;
+//     assert(res[i] == (key / 2 + 1 < N ? &pool[key / 2 + 1].node : NULL));
+//     assert((levels[i] != 0) == (key % 2 == 0));
+//   }
+//
+//   free(levels);
+//   free(res);
+//   free(keys);
+//   free(nodes);
+//   free(probes);
+//   free(pool);
+// }
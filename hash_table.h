@@ -0,0 +1,1629 @@
+#ifndef HAOMI_HASH_TABLE_H
+#define HAOMI_HASH_TABLE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace haomi {
+
+// Finalizer of murmur3, spreads every bit of the key over the low bits used
+// as the bucket index.
+struct MurmurMix {
+  size_t operator()(uint64_t key) const {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb3fe1a85ec53ULL;
+    key ^= key >> 33;
+    return static_cast<size_t>(key);
+  }
+};
+
+template <typename Key>
+struct DefaultHash {
+  size_t operator()(const Key &key) const {
+    return MurmurMix{}(std::hash<Key>{}(key));
+  }
+};
+
+// The key itself, the division hash of the hw9 HashTable once the table
+// takes the low bits. Clusters on keys sharing their low bits.
+struct IdentityHash {
+  size_t operator()(uint64_t key) const { return static_cast<size_t>(key); }
+};
+
+// Multiply shift (Fibonacci hashing). The good bits of the product are the
+// high ones, they are moved down to where the table looks.
+struct MultiplyShiftHash {
+  size_t operator()(uint64_t key) const {
+    return static_cast<size_t>((key * 0x9e3779b97f4a7c15ULL) >> 32);
+  }
+};
+
+// Final avalanche of xxhash64.
+struct XxhMix {
+  size_t operator()(uint64_t key) const {
+    key ^= key >> 33;
+    key *= 0xc2b2ae3d27d4eb4fULL;
+    key ^= key >> 29;
+    key *= 0x165667b19e3779f9ULL;
+    key ^= key >> 32;
+    return static_cast<size_t>(key);
+  }
+};
+
+// What a table looks like inside, from stats() of a table or from
+// chainedDistribution / openDistribution.
+// For a chained table histogram[L] counts the buckets holding L keys and
+// maxProbe is the longest chain. For an open table histogram[d] counts the
+// keys lying d slots past their home and maxProbe is the longest probe, in
+// slots looked at.
+struct HashTableStats {
+  size_t size = 0;
+  size_t buckets = 0;
+  double loadFactor = 0;
+  double ASL1 = 0;
+  double ASL2 = 0;
+  size_t maxProbe = 0;
+  std::vector<size_t> histogram;
+
+  void print(std::ostream &out = std::cout) const {
+    out << size << " keys in " << buckets << " buckets, load factor "
+        << loadFactor << ", ASL1 " << ASL1 << ", ASL2 " << ASL2
+        << ", max probe " << maxProbe << "\n";
+    for (size_t i = 0; i < histogram.size(); ++i) {
+      if (histogram[i]) {
+        out << "  " << i << ": " << histogram[i] << "\n";
+      }
+    }
+  }
+};
+
+template <typename Hist>
+inline void _addToHistogram(Hist &histogram, size_t value) {
+  if (histogram.size() <= value) {
+    histogram.resize(value + 1);
+  }
+  ++histogram[value];
+}
+
+// Open addressing hash set, Robin Hood linear probing.
+// Keys live inline in one array and a parallel array of 16 bit counters holds
+// the probe distance of every slot (0 for an empty slot), so a lookup scans a
+// few adjacent counters and keys instead of chasing list nodes. An insert
+// takes the slot of any key closer to its home than itself, which keeps the
+// probe distances short and even. A remove shifts the following keys back by
+// one slot, so no tombstone is left behind.
+// The capacity is a power of 2 and doubles once the load factor would pass
+// maxLoadFactor.
+template <typename Key, typename Hash = DefaultHash<Key>,
+          typename KeyEqual = std::equal_to<Key>>
+class OpenHashTable {
+ public:
+  explicit OpenHashTable(size_t capacity = 16, double maxLoadFactor = 0.875,
+                         const Hash &hash = Hash(),
+                         const KeyEqual &equal = KeyEqual())
+      : maxLoadFactor(maxLoadFactor), hashFunc(hash), keyEqual(equal) {
+    if (!(maxLoadFactor > 0 && maxLoadFactor < 1)) {
+      this->maxLoadFactor = 0.875;
+    }
+    size_t cap = MIN_CAPACITY;
+    while (cap < capacity) {
+      cap *= 2;
+    }
+    allocate(cap);
+  }
+
+  OpenHashTable(const OpenHashTable &) = delete;
+  OpenHashTable &operator=(const OpenHashTable &) = delete;
+
+  OpenHashTable(OpenHashTable &&other) noexcept { steal(other); }
+
+  OpenHashTable &operator=(OpenHashTable &&other) noexcept {
+    if (this != &other) {
+      release();
+      steal(other);
+    }
+    return *this;
+  }
+
+  ~OpenHashTable() { release(); }
+
+  // Returns false if the key is already in the table.
+  bool insert(const Key &key) {
+    if (contains(key)) {
+      return false;
+    }
+    if (numElements + 1 > growThreshold) {
+      rehash(capacity * 2);
+    }
+    place(Key(key));
+    return true;
+  }
+
+  // Returns false if the key is not in the table.
+  bool remove(const Key &key) {
+    size_t pos;
+    if (!find(key, pos)) {
+      return false;
+    }
+    // Backward shift: pull every following displaced key one slot closer to
+    // its home, until an empty slot or a key already at home.
+    size_t next = (pos + 1) & mask;
+    while (dist[next] > 1) {
+      keys[pos] = std::move(keys[next]);
+      dist[pos] = dist[next] - 1;
+      pos = next;
+      next = (next + 1) & mask;
+    }
+    keys[pos].~Key();
+    dist[pos] = 0;
+    --numElements;
+    return true;
+  }
+
+  bool contains(const Key &key) const {
+    size_t pos;
+    return find(key, pos);
+  }
+
+  size_t size() const { return numElements; }
+
+  size_t bucketCount() const { return capacity; }
+
+  double loadFactor() const {
+    return static_cast<double>(numElements) / capacity;
+  }
+
+  void clear() {
+    for (size_t i = 0; i < capacity; ++i) {
+      if (dist[i]) {
+        keys[i].~Key();
+        dist[i] = 0;
+      }
+    }
+    numElements = 0;
+  }
+
+  // Grow to at least the given number of slots.
+  void reserve(size_t count) {
+    size_t cap = capacity;
+    while (count > static_cast<size_t>(cap * maxLoadFactor)) {
+      cap *= 2;
+    }
+    if (cap != capacity) {
+      rehash(cap);
+    }
+  }
+
+  // Average number of compares of a successful search, the probe distance
+  // of a key plus one, over all the keys.
+  double ASL1() const {
+    if (numElements == 0) return 0.0;
+    size_t sum = 0;
+    for (size_t i = 0; i < capacity; ++i) {
+      sum += dist[i];
+    }
+    return static_cast<double>(sum) / numElements;
+  }
+
+  // Average number of slots looked at by an unsuccessful search, over all
+  // the home slots. The search stops at an empty slot or at a key closer to
+  // its home than the searched key would be.
+  double ASL2() const {
+    size_t sum = 0;
+    for (size_t home = 0; home < capacity; ++home) {
+      size_t d = 1;
+      while (dist[(home + d - 1) & mask] >= d) {
+        ++d;
+      }
+      sum += d;
+    }
+    return static_cast<double>(sum) / capacity;
+  }
+
+  // O(capacity), meant to be sampled now and then, e.g. to follow the load
+  // factor and the longest probe as the table fills.
+  HashTableStats stats() const {
+    HashTableStats res;
+    res.size = numElements;
+    res.buckets = capacity;
+    res.loadFactor = loadFactor();
+    res.ASL1 = ASL1();
+    res.ASL2 = ASL2();
+    for (size_t i = 0; i < capacity; ++i) {
+      if (dist[i]) {
+        _addToHistogram(res.histogram, dist[i] - 1);
+        res.maxProbe = std::max<size_t>(res.maxProbe, dist[i]);
+      }
+    }
+    return res;
+  }
+
+  void printTable() const {
+    std::cout << "OpenHashTable (" << capacity << " slots):\n";
+    for (size_t i = 0; i < capacity; ++i) {
+      std::cout << "slot " << i << ": ";
+      if (dist[i] == 0) {
+        std::cout << "empty\n";
+      } else {
+        std::cout << keys[i] << " (distance " << dist[i] - 1 << ")\n";
+      }
+    }
+    std::cout << "size: " << numElements << "\n\n";
+  }
+
+  // Visit every key, in slot order.
+  template <typename Func>
+  void forEach(Func &&func) const {
+    for (size_t i = 0; i < capacity; ++i) {
+      if (dist[i]) {
+        func(keys[i]);
+      }
+    }
+  }
+
+ private:
+  static constexpr size_t MIN_CAPACITY = 8;
+  // A probe longer than this forces the table to grow. A hash which sends
+  // more keys than this to a few slots cannot be helped by growing and is
+  // not supported.
+  static constexpr uint16_t MAX_DIST = UINT16_MAX;
+
+  Key *keys = nullptr;
+  // Probe distance plus one, 0 for an empty slot.
+  uint16_t *dist = nullptr;
+  size_t capacity = 0;
+  size_t mask = 0;
+  size_t numElements = 0;
+  size_t growThreshold = 0;
+  double maxLoadFactor = 0.875;
+  Hash hashFunc;
+  KeyEqual keyEqual;
+
+  void allocate(size_t cap) {
+    keys = static_cast<Key *>(::operator new(sizeof(Key) * cap));
+    dist = new uint16_t[cap]();
+    capacity = cap;
+    mask = cap - 1;
+    numElements = 0;
+    growThreshold = static_cast<size_t>(cap * maxLoadFactor);
+  }
+
+  void release() {
+    if (keys == nullptr) {
+      return;
+    }
+    clear();
+    ::operator delete(keys);
+    delete[] dist;
+    keys = nullptr;
+    dist = nullptr;
+  }
+
+  void steal(OpenHashTable &other) {
+    keys = other.keys, dist = other.dist;
+    capacity = other.capacity, mask = other.mask;
+    numElements = other.numElements, growThreshold = other.growThreshold;
+    maxLoadFactor = other.maxLoadFactor;
+    hashFunc = std::move(other.hashFunc);
+    keyEqual = std::move(other.keyEqual);
+    other.keys = nullptr, other.dist = nullptr;
+    other.capacity = other.mask = other.numElements = other.growThreshold = 0;
+  }
+
+  bool find(const Key &key, size_t &pos) const {
+    pos = hashFunc(key) & mask;
+    // A key at distance d from its home cannot lie past a slot whose key is
+    // closer than d to its own home.
+    for (uint16_t d = 1; dist[pos] >= d; ++d) {
+      if (dist[pos] == d && keyEqual(keys[pos], key)) {
+        return true;
+      }
+      pos = (pos + 1) & mask;
+    }
+    return false;
+  }
+
+  // The key must not be in the table and there must be a free slot.
+  void place(Key &&key) {
+    size_t pos = hashFunc(key) & mask;
+    uint16_t d = 1;
+    while (true) {
+      if (dist[pos] == 0) {
+        new (&keys[pos]) Key(std::move(key));
+        dist[pos] = d;
+        ++numElements;
+        return;
+      }
+      // Robin Hood: the poorer key takes the slot.
+      if (dist[pos] < d) {
+        std::swap(keys[pos], key);
+        std::swap(dist[pos], d);
+      }
+      pos = (pos + 1) & mask;
+      if (++d == MAX_DIST) {
+        // Pathological clustering, grow and place the key in hand again.
+        rehash(capacity * 2);
+        place(std::move(key));
+        return;
+      }
+    }
+  }
+
+  void rehash(size_t cap) {
+    Key *oldKeys = keys;
+    uint16_t *oldDist = dist;
+    size_t oldCapacity = capacity;
+    allocate(cap);
+    for (size_t i = 0; i < oldCapacity; ++i) {
+      if (oldDist[i]) {
+        place(std::move(oldKeys[i]));
+        oldKeys[i].~Key();
+      }
+    }
+    ::operator delete(oldKeys);
+    delete[] oldDist;
+  }
+};
+
+// Separate chaining hash set which grows without stopping the world.
+// When the load factor would pass maxLoadFactor a table of twice the size is
+// allocated next to the old one, and from then on every insert, lookup and
+// remove moves the chains of the next migrateStep old buckets over, until
+// the old table is empty and released. A key is looked up in the old table
+// if its old bucket has not been moved yet, in the new one otherwise.
+// The bucket arrays come from calloc, which hands out fresh zeroed pages
+// for a large table instead of clearing them up front.
+template <typename Key, typename Hash = DefaultHash<Key>,
+          typename KeyEqual = std::equal_to<Key>>
+class ChainedHashTable {
+ public:
+  explicit ChainedHashTable(size_t size = 16, double maxLoadFactor = 1.0,
+                            size_t migrateStep = 8, const Hash &hash = Hash(),
+                            const KeyEqual &equal = KeyEqual())
+      : maxLoadFactor(maxLoadFactor > 0 ? maxLoadFactor : 1.0),
+        migrateStep(migrateStep ? migrateStep : 1),
+        hashFunc(hash),
+        keyEqual(equal) {
+    size_t cap = MIN_SIZE;
+    while (cap < size) {
+      cap *= 2;
+    }
+    table = allocateBuckets(cap);
+    TABLE_SIZE = cap;
+    growThreshold = static_cast<size_t>(cap * this->maxLoadFactor);
+  }
+
+  ChainedHashTable(const ChainedHashTable &) = delete;
+  ChainedHashTable &operator=(const ChainedHashTable &) = delete;
+
+  ~ChainedHashTable() {
+    releaseBuckets(oldTable, oldSize);
+    releaseBuckets(table, TABLE_SIZE);
+  }
+
+  // Returns false if the key is already in the table.
+  bool insert(const Key &key) {
+    migrate();
+    size_t hash = hashFunc(key);
+    if (findIn(bucketOf(hash), key)) {
+      return false;
+    }
+    if (numElements + 1 > growThreshold) {
+      grow();
+    }
+    Node **bucket = bucketOf(hash);
+    *bucket = new Node{*bucket, key};
+    ++numElements;
+    return true;
+  }
+
+  // Returns false if the key is not in the table.
+  bool remove(const Key &key) {
+    migrate();
+    Node **link = bucketOf(hashFunc(key));
+    for (; *link; link = &(*link)->next) {
+      if (keyEqual((*link)->key, key)) {
+        Node *node = *link;
+        *link = node->next;
+        delete node;
+        --numElements;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Not const, a lookup moves its share of the buckets as well.
+  bool contains(const Key &key) {
+    migrate();
+    return findIn(bucketOf(hashFunc(key)), key);
+  }
+
+  size_t size() const { return numElements; }
+
+  size_t bucketCount() const { return TABLE_SIZE; }
+
+  bool isRehashing() const { return oldTable != nullptr; }
+
+  // ASL1 = (1 / n) * sum of L * (L + 1) / 2 over the chains, L the length of
+  // a chain, over the buckets of both tables while rehashing.
+  double ASL1() const {
+    if (numElements == 0) return 0.0;
+    size_t sum = 0;
+    forEachChain([&sum](size_t len) { sum += len * (len + 1) / 2; });
+    return static_cast<double>(sum) / numElements;
+  }
+
+  // Average length of a chain, the compares of an unsuccessful search.
+  double ASL2() const {
+    size_t buckets = 0;
+    forEachChain([&buckets](size_t) { ++buckets; });
+    return static_cast<double>(numElements) / buckets;
+  }
+
+  // O(buckets), meant to be sampled now and then.
+  HashTableStats stats() const {
+    HashTableStats res;
+    res.size = numElements;
+    forEachChain([&res](size_t len) {
+      ++res.buckets;
+      _addToHistogram(res.histogram, len);
+      res.maxProbe = std::max(res.maxProbe, len);
+    });
+    res.loadFactor = static_cast<double>(numElements) / res.buckets;
+    res.ASL1 = ASL1();
+    res.ASL2 = ASL2();
+    return res;
+  }
+
+  void printTable() const {
+    std::cout << "ChainedHashTable (" << TABLE_SIZE << " buckets";
+    if (oldTable) {
+      std::cout << ", " << oldSize - migratePos << " old buckets left";
+    }
+    std::cout << "):\n";
+    for (size_t i = 0; i < TABLE_SIZE; ++i) {
+      std::cout << "bucket " << i << ": ";
+      for (Node *node = table[i]; node; node = node->next) {
+        std::cout << node->key << " -> ";
+      }
+      std::cout << "NULL\n";
+    }
+    std::cout << "size: " << numElements << "\n\n";
+  }
+
+  // Visit every key, the buckets not moved yet first.
+  template <typename Func>
+  void forEach(Func &&func) const {
+    for (size_t i = oldTable ? migratePos : oldSize; i < oldSize; ++i) {
+      for (Node *node = oldTable[i]; node; node = node->next) func(node->key);
+    }
+    for (size_t i = 0; i < TABLE_SIZE; ++i) {
+      for (Node *node = table[i]; node; node = node->next) func(node->key);
+    }
+  }
+
+ private:
+  struct Node {
+    Node *next;
+    Key key;
+  };
+
+  static constexpr size_t MIN_SIZE = 8;
+
+  Node **table = nullptr;
+  size_t TABLE_SIZE = 0;
+  // The table being emptied, and the first of its buckets not moved yet.
+  Node **oldTable = nullptr;
+  size_t oldSize = 0;
+  size_t migratePos = 0;
+  size_t numElements = 0;
+  size_t growThreshold = 0;
+  double maxLoadFactor;
+  size_t migrateStep;
+  Hash hashFunc;
+  KeyEqual keyEqual;
+
+  static Node **allocateBuckets(size_t count) {
+    Node **buckets = static_cast<Node **>(std::calloc(count, sizeof(Node *)));
+    if (buckets == nullptr) {
+      throw std::bad_alloc();
+    }
+    return buckets;
+  }
+
+  static void releaseBuckets(Node **buckets, size_t count) {
+    if (buckets == nullptr) {
+      return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+      while (buckets[i]) {
+        Node *next = buckets[i]->next;
+        delete buckets[i];
+        buckets[i] = next;
+      }
+    }
+    std::free(buckets);
+  }
+
+  Node **bucketOf(size_t hash) {
+    if (oldTable && (hash & (oldSize - 1)) >= migratePos) {
+      return &oldTable[hash & (oldSize - 1)];
+    }
+    return &table[hash & (TABLE_SIZE - 1)];
+  }
+
+  bool findIn(Node **bucket, const Key &key) const {
+    for (Node *node = *bucket; node; node = node->next) {
+      if (keyEqual(node->key, key)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  template <typename Func>
+  void forEachChain(Func &&func) const {
+    for (size_t i = oldTable ? migratePos : oldSize; i < oldSize; ++i) {
+      size_t len = 0;
+      for (Node *node = oldTable[i]; node; node = node->next) ++len;
+      func(len);
+    }
+    for (size_t i = 0; i < TABLE_SIZE; ++i) {
+      size_t len = 0;
+      for (Node *node = table[i]; node; node = node->next) ++len;
+      func(len);
+    }
+  }
+
+  // Move the chains of up to count old buckets.
+  void migrate(size_t count) {
+    for (; oldTable && count > 0; --count) {
+      Node *node = oldTable[migratePos];
+      while (node) {
+        Node *next = node->next;
+        Node **bucket = &table[hashFunc(node->key) & (TABLE_SIZE - 1)];
+        node->next = *bucket;
+        *bucket = node;
+        node = next;
+      }
+      // The nodes belong to table now, the destructor must not see them here.
+      oldTable[migratePos] = nullptr;
+      if (++migratePos == oldSize) {
+        std::free(oldTable);
+        oldTable = nullptr;
+        oldSize = migratePos = 0;
+      }
+    }
+  }
+
+  void migrate() { migrate(migrateStep); }
+
+  void grow() {
+    // The new table holds twice the keys, with migrateStep >= 1 the old one
+    // is normally empty long before the next growth. Finish it if not.
+    if (oldTable) {
+      migrate(oldSize - migratePos);
+    }
+    oldTable = table;
+    oldSize = TABLE_SIZE;
+    migratePos = 0;
+    table = allocateBuckets(TABLE_SIZE * 2);
+    TABLE_SIZE *= 2;
+    growThreshold = static_cast<size_t>(TABLE_SIZE * maxLoadFactor);
+  }
+};
+
+// The stats a chained table of the given number of buckets would show after
+// inserting the keys in [first, last), taken as distinct, with hash, without
+// building it, so that hash functions can be compared on the same keys.
+template <typename Iter, typename Hash>
+HashTableStats chainedDistribution(Iter first, Iter last, Hash hash,
+                                   size_t buckets) {
+  std::vector<size_t> chains(buckets);
+  HashTableStats res;
+  for (; first != last; ++first) {
+    ++chains[hash(*first) % buckets];
+    ++res.size;
+  }
+  size_t sum = 0;
+  res.buckets = buckets;
+  for (size_t len : chains) {
+    _addToHistogram(res.histogram, len);
+    res.maxProbe = std::max(res.maxProbe, len);
+    sum += len * (len + 1) / 2;
+  }
+  res.loadFactor = static_cast<double>(res.size) / buckets;
+  res.ASL1 = res.size ? static_cast<double>(sum) / res.size : 0.0;
+  res.ASL2 = res.loadFactor;
+  return res;
+}
+
+// The same for a Robin Hood table of capacity slots, a power of 2 larger
+// than the number of keys. Only the probe distances are kept, which is all
+// the Robin Hood rule looks at.
+template <typename Iter, typename Hash>
+HashTableStats openDistribution(Iter first, Iter last, Hash hash,
+                                size_t capacity) {
+  std::vector<size_t> dist(capacity);
+  size_t mask = capacity - 1;
+  HashTableStats res;
+  for (; first != last && res.size < capacity; ++first, ++res.size) {
+    size_t pos = hash(*first) & mask, d = 1;
+    while (dist[pos]) {
+      if (dist[pos] < d) {
+        std::swap(dist[pos], d);
+      }
+      pos = (pos + 1) & mask;
+      ++d;
+    }
+    dist[pos] = d;
+  }
+  size_t sum = 0, probes = 0;
+  for (size_t d : dist) {
+    if (d) {
+      _addToHistogram(res.histogram, d - 1);
+      res.maxProbe = std::max(res.maxProbe, d);
+      sum += d;
+    }
+  }
+  for (size_t home = 0; home < capacity; ++home) {
+    size_t d = 1;
+    while (d <= capacity && dist[(home + d - 1) & mask] >= d) {
+      ++d;
+    }
+    probes += d;
+  }
+  res.buckets = capacity;
+  res.loadFactor = static_cast<double>(res.size) / capacity;
+  res.ASL1 = res.size ? static_cast<double>(sum) / res.size : 0.0;
+  res.ASL2 = static_cast<double>(probes) / capacity;
+  return res;
+}
+
+// Concurrent hash set for keys which are trivially copyable, such as ints.
+// The keys are spread over shards by a remix of the hash. A shard is a
+// Robin Hood table like OpenHashTable, with a mutex for its writers and a
+// sequence counter for its readers: a writer makes the counter odd while it
+// moves keys and even again after, a reader never locks and reads again if
+// the counter changed under it. Slots are atomics, so a reader racing with a
+// writer sees old or new keys, never torn ones, and throws the result away.
+// A table replaced by a larger one is kept until the set is destroyed, since
+// a reader may still be in it. The old tables of a shard take less memory
+// than its current one.
+// Every shard counts its own keys, size() adds the counts up.
+template <typename Key, typename Hash = DefaultHash<Key>>
+class ConcurrentHashSet {
+  static_assert(std::is_trivially_copyable<Key>::value,
+                "the keys are copied by the readers without a lock");
+
+ public:
+  explicit ConcurrentHashSet(size_t shardCount = 64, size_t capacity = 1024,
+                             double maxLoadFactor = 0.875,
+                             const Hash &hash = Hash())
+      : maxLoadFactor(maxLoadFactor > 0 && maxLoadFactor < 1 ? maxLoadFactor
+                                                             : 0.875),
+        hashFunc(hash) {
+    size_t count = 1;
+    while (count < shardCount && count < MAX_SHARDS) {
+      count *= 2;
+    }
+    shardMask = count - 1;
+    shards.reset(new Shard[count]);
+    size_t cap = MIN_CAPACITY;
+    while (cap * count < capacity) {
+      cap *= 2;
+    }
+    for (size_t i = 0; i < count; ++i) {
+      shards[i].table.store(makeTable(cap, nullptr), std::memory_order_relaxed);
+      shards[i].growThreshold = static_cast<size_t>(cap * this->maxLoadFactor);
+    }
+  }
+
+  ConcurrentHashSet(const ConcurrentHashSet &) = delete;
+  ConcurrentHashSet &operator=(const ConcurrentHashSet &) = delete;
+
+  // No thread may be using the set.
+  ~ConcurrentHashSet() {
+    for (size_t i = 0; i <= shardMask; ++i) {
+      Table *table = shards[i].table.load(std::memory_order_relaxed);
+      while (table) {
+        Table *prev = table->prev;
+        delete[] table->slots;
+        delete table;
+        table = prev;
+      }
+    }
+  }
+
+  // Returns false if the key is already in the set.
+  bool insert(const Key &key) {
+    size_t hash = hashFunc(key);
+    Shard &shard = shardOf(hash);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    Table *table = shard.table.load(std::memory_order_relaxed);
+    if (probe(table, key, hash)) {
+      return false;
+    }
+    if (shard.count.load(std::memory_order_relaxed) + 1 >
+        shard.growThreshold) {
+      table = grow(shard, table, (table->mask + 1) * 2);
+    }
+    Key carry = key;
+    writeBegin(shard);
+    if (!place(table, carry, hash & table->mask, 1)) {
+      // Pathological clustering, the key displaced last is still in hand and
+      // in no table, so the readers are kept out until the new table that
+      // holds it is published.
+      grow(shard, table, (table->mask + 1) * 2, &carry, true);
+    }
+    writeEnd(shard);
+    shard.count.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Returns false if the key is not in the set.
+  bool remove(const Key &key) {
+    size_t hash = hashFunc(key);
+    Shard &shard = shardOf(hash);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    Table *table = shard.table.load(std::memory_order_relaxed);
+    size_t pos;
+    if (!probe(table, key, hash, &pos)) {
+      return false;
+    }
+    writeBegin(shard);
+    // Backward shift, as in OpenHashTable.
+    size_t next = (pos + 1) & table->mask;
+    uint16_t d;
+    while ((d = table->slots[next].dist.load(std::memory_order_relaxed)) >
+           1) {
+      table->slots[pos].key.store(
+          table->slots[next].key.load(std::memory_order_relaxed),
+          std::memory_order_relaxed);
+      table->slots[pos].dist.store(d - 1, std::memory_order_relaxed);
+      pos = next;
+      next = (next + 1) & table->mask;
+    }
+    table->slots[pos].dist.store(0, std::memory_order_relaxed);
+    writeEnd(shard);
+    shard.count.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Never takes a lock.
+  bool contains(const Key &key) const {
+    size_t hash = hashFunc(key);
+    const Shard &shard = shardOf(hash);
+    while (true) {
+      size_t seq = shard.seq.load(std::memory_order_acquire);
+      if (seq & 1) {
+        std::this_thread::yield();
+        continue;
+      }
+      bool found =
+          probe(shard.table.load(std::memory_order_acquire), key, hash);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (shard.seq.load(std::memory_order_relaxed) == seq) {
+        return found;
+      }
+    }
+  }
+
+  // Exact only while no writer is running.
+  size_t size() const {
+    size_t sum = 0;
+    for (size_t i = 0; i <= shardMask; ++i) {
+      sum += shards[i].count.load(std::memory_order_relaxed);
+    }
+    return sum;
+  }
+
+  size_t shardCount() const { return shardMask + 1; }
+
+  size_t shardSize(size_t shard) const {
+    return shards[shard].count.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Slot {
+    std::atomic<Key> key;
+    // Probe distance plus one, 0 for an empty slot.
+    std::atomic<uint16_t> dist;
+  };
+
+  struct Table {
+    Slot *slots;
+    size_t mask;
+    // The table this one replaced.
+    Table *prev;
+  };
+
+  // One cache line each, so that the writers of two shards do not share one.
+  struct alignas(64) Shard {
+    std::mutex lock;
+    std::atomic<size_t> seq{0};
+    std::atomic<Table *> table{nullptr};
+    std::atomic<size_t> count{0};
+    size_t growThreshold = 0;
+  };
+
+  static constexpr size_t MIN_CAPACITY = 8;
+  static constexpr size_t MAX_SHARDS = 65536;
+  static constexpr uint16_t MAX_DIST = UINT16_MAX;
+
+  std::unique_ptr<Shard[]> shards;
+  size_t shardMask = 0;
+  double maxLoadFactor;
+  Hash hashFunc;
+
+  // The table takes the low bits of the hash, the shard those of a remix,
+  // so that a weak hash such as IdentityHash still spreads the keys over all
+  // the shards.
+  Shard &shardOf(size_t hash) { return shards[MurmurMix{}(hash) & shardMask]; }
+
+  const Shard &shardOf(size_t hash) const {
+    return shards[MurmurMix{}(hash) & shardMask];
+  }
+
+  static Table *makeTable(size_t cap, Table *prev) {
+    return new Table{new Slot[cap](), cap - 1, prev};
+  }
+
+  static void writeBegin(Shard &shard) {
+    shard.seq.store(shard.seq.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  static void writeEnd(Shard &shard) {
+    shard.seq.store(shard.seq.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+  }
+
+  // A reader may see the table half way through a write, the probe length
+  // is bounded so that it always returns.
+  static bool probe(const Table *table, const Key &key, size_t hash,
+                    size_t *at = nullptr) {
+    size_t pos = hash & table->mask;
+    for (size_t d = 1; d <= table->mask + 1; ++d) {
+      uint16_t slotDist =
+          table->slots[pos].dist.load(std::memory_order_relaxed);
+      if (slotDist < d) {
+        return false;
+      }
+      if (slotDist == d &&
+          table->slots[pos].key.load(std::memory_order_relaxed) == key) {
+        if (at) *at = pos;
+        return true;
+      }
+      pos = (pos + 1) & table->mask;
+    }
+    return false;
+  }
+
+  // Robin Hood insert of carry starting at pos with distance d. Returns
+  // false if a probe would pass MAX_DIST, the key in hand is then in carry.
+  static bool place(Table *table, Key &carry, size_t pos, uint16_t d) {
+    while (true) {
+      uint16_t slotDist =
+          table->slots[pos].dist.load(std::memory_order_relaxed);
+      if (slotDist == 0) {
+        table->slots[pos].key.store(carry, std::memory_order_relaxed);
+        table->slots[pos].dist.store(d, std::memory_order_relaxed);
+        return true;
+      }
+      if (slotDist < d) {
+        Key tmp = table->slots[pos].key.load(std::memory_order_relaxed);
+        table->slots[pos].key.store(carry, std::memory_order_relaxed);
+        table->slots[pos].dist.store(d, std::memory_order_relaxed);
+        carry = tmp;
+        d = slotDist;
+      }
+      pos = (pos + 1) & table->mask;
+      if (++d == MAX_DIST) {
+        return false;
+      }
+    }
+  }
+
+  // Build a table of cap slots with the keys of table, plus extra, out of
+  // sight of the readers, then publish it. Returns the new table. writing
+  // tells that the caller has already begun a write, which it ends.
+  Table *grow(Shard &shard, Table *table, size_t cap,
+              const Key *extra = nullptr, bool writing = false) {
+    while (true) {
+      Table *bigger = makeTable(cap, table);
+      bool placed = true;
+      for (size_t i = 0; i <= table->mask && placed; ++i) {
+        if (table->slots[i].dist.load(std::memory_order_relaxed)) {
+          Key carry = table->slots[i].key.load(std::memory_order_relaxed);
+          placed = place(bigger, carry, hashFunc(carry) & bigger->mask, 1);
+        }
+      }
+      if (placed && extra) {
+        Key carry = *extra;
+        placed = place(bigger, carry, hashFunc(carry) & bigger->mask, 1);
+      }
+      if (placed) {
+        if (!writing) {
+          writeBegin(shard);
+        }
+        shard.table.store(bigger, std::memory_order_release);
+        if (!writing) {
+          writeEnd(shard);
+        }
+        shard.growThreshold = static_cast<size_t>(cap * maxLoadFactor);
+        return bigger;
+      }
+      delete[] bigger->slots;
+      delete bigger;
+      cap *= 2;
+    }
+  }
+};
+
+// Cuckoo filter (Fan et al.), approximate membership with deletes.
+// Every key leaves an f bit fingerprint in one of two buckets of 4 slots, the
+// second bucket being the first xor a hash of the fingerprint, so that a
+// fingerprint moves between its buckets without the key. The buckets are
+// packed 4 * f bits apiece, and a lookup reads its two buckets as two words
+// and tests the 4 slots of each at once (the zero lane test of SWAR).
+// A key never inserted is reported with probability below 8 / 2^f, so f is
+// the smallest giving falsePositiveRate, between 4 and 16 bits.
+// Only keys which were inserted may be removed. Once an insert has moved
+// MAX_KICKS fingerprints without finding a free slot, the fingerprint in
+// hand is set aside and the filter is full: later inserts return false
+// and the filter has to be rebuilt larger from the keys.
+template <typename Key, typename Hash = DefaultHash<Key>>
+class CuckooFilter {
+ public:
+  explicit CuckooFilter(size_t capacity = 1024, double falsePositiveRate = 0.01,
+                        const Hash &hash = Hash())
+      : hashFunc(hash) {
+    bits = MIN_BITS;
+    while (bits < MAX_BITS &&
+           8.0 / static_cast<double>(1u << bits) > falsePositiveRate) {
+      ++bits;
+    }
+    lanesLow = 0;
+    for (size_t i = 0; i < SLOTS; ++i) {
+      lanesLow |= uint64_t{1} << (i * bits);
+    }
+    lanesHigh = lanesLow << (bits - 1);
+    fingerprintMask = (uint64_t{1} << bits) - 1;
+    bucketBits = SLOTS * bits;
+    bucketValueMask =
+        bucketBits == 64 ? ~uint64_t{0} : (uint64_t{1} << bucketBits) - 1;
+    size_t buckets = 1;
+    while (buckets * SLOTS * MAX_LOAD < capacity) {
+      buckets *= 2;
+    }
+    bucketMask = buckets - 1;
+    // One more word, a bucket may end in it.
+    words.assign((buckets * bucketBits + 63) / 64 + 1, 0);
+  }
+
+  // Returns false if the filter is full, the key is then not recorded.
+  bool insert(const Key &key) {
+    if (hasVictim) {
+      return false;
+    }
+    size_t index;
+    uint64_t fp = fingerprint(hashFunc(key), index);
+    if (put(index, fp) || put(altIndex(index, fp), fp)) {
+      ++count;
+      return true;
+    }
+    if (nextRandom() & 1) {
+      index = altIndex(index, fp);
+    }
+    for (size_t kick = 0; kick < MAX_KICKS; ++kick) {
+      // Swap with a random slot and carry the old fingerprint on to its
+      // other bucket.
+      size_t slot = nextRandom() % SLOTS;
+      uint64_t out = get(index, slot);
+      set(index, slot, fp);
+      fp = out;
+      index = altIndex(index, fp);
+      if (put(index, fp)) {
+        ++count;
+        return true;
+      }
+    }
+    victimIndex = index;
+    victim = fp;
+    hasVictim = true;
+    ++count;
+    return true;
+  }
+
+  // key must have been inserted. Returns false if no fingerprint of it is
+  // found, which then means it was not.
+  bool remove(const Key &key) {
+    size_t index;
+    uint64_t fp = fingerprint(hashFunc(key), index);
+    size_t alt = altIndex(index, fp);
+    if (take(index, fp) || take(alt, fp)) {
+      --count;
+      if (hasVictim) {
+        // Room was made, the fingerprint set aside gets a second chance.
+        hasVictim = false;
+        if (!put(victimIndex, victim) &&
+            !put(altIndex(victimIndex, victim), victim)) {
+          hasVictim = true;
+        }
+      }
+      return true;
+    }
+    if (hasVictim && victim == fp &&
+        (victimIndex == index || victimIndex == alt)) {
+      hasVictim = false;
+      --count;
+      return true;
+    }
+    return false;
+  }
+
+  // False means the key was never inserted (or was removed since).
+  bool mayContain(const Key &key) const {
+    size_t index;
+    uint64_t fp = fingerprint(hashFunc(key), index);
+    size_t alt = altIndex(index, fp);
+    // Both buckets are read before either is tested, the two cache misses
+    // then overlap.
+    uint64_t first = bucket(index), second = bucket(alt);
+    if (holds(first, fp) | holds(second, fp)) {
+      return true;
+    }
+    return hasVictim && victim == fp &&
+           (victimIndex == index || victimIndex == alt);
+  }
+
+  bool full() const { return hasVictim; }
+
+  size_t size() const { return count; }
+
+  size_t capacity() const { return (bucketMask + 1) * SLOTS; }
+
+  size_t fingerprintBits() const { return bits; }
+
+  size_t sizeInBytes() const { return sizeof(*this) + words.size() * 8; }
+
+  void clear() {
+    std::fill(words.begin(), words.end(), 0);
+    count = 0;
+    hasVictim = false;
+  }
+
+ private:
+  static constexpr size_t SLOTS = 4;
+  static constexpr size_t MIN_BITS = 4;
+  static constexpr size_t MAX_BITS = 16;
+  static constexpr size_t MAX_KICKS = 500;
+  // Buckets of 4 fill to about 95% before an insert fails.
+  static constexpr double MAX_LOAD = 0.9;
+
+  std::vector<uint64_t> words;
+  size_t bucketMask;
+  size_t bits, bucketBits;
+  uint64_t lanesLow, lanesHigh, fingerprintMask, bucketValueMask;
+  size_t count = 0;
+  size_t victimIndex = 0;
+  uint64_t victim = 0;
+  bool hasVictim = false;
+  uint64_t seed = 0x9e3779b97f4a7c15ULL;
+  Hash hashFunc;
+
+  // A fingerprint is never 0, the value of an empty slot. The bucket comes
+  // from the low bits of the hash and the fingerprint from a remix of it, so
+  // that a weak hash such as IdentityHash, whose high bits are 0 for small
+  // keys, still gives fingerprints apart from the bucket.
+  uint64_t fingerprint(size_t hash, size_t &index) const {
+    uint64_t h = static_cast<uint64_t>(hash);
+    index = static_cast<size_t>(h) & bucketMask;
+    uint64_t fp = static_cast<uint64_t>(MurmurMix{}(h)) & fingerprintMask;
+    return fp ? fp : 1;
+  }
+
+  size_t altIndex(size_t index, uint64_t fp) const {
+    return (index ^ MurmurMix{}(fp)) & bucketMask;
+  }
+
+  uint64_t bucket(size_t index) const {
+    size_t offset = index * bucketBits, word = offset / 64, shift = offset % 64;
+    uint64_t value = words[word] >> shift;
+    if (shift + bucketBits > 64) {
+      value |= words[word + 1] << (64 - shift);
+    }
+    return value & bucketValueMask;
+  }
+
+  void store(size_t index, uint64_t value) {
+    size_t offset = index * bucketBits, word = offset / 64, shift = offset % 64;
+    words[word] = (words[word] & ~(bucketValueMask << shift)) | value << shift;
+    if (shift + bucketBits > 64) {
+      uint64_t high = bucketValueMask >> (64 - shift);
+      words[word + 1] = (words[word + 1] & ~high) | value >> (64 - shift);
+    }
+  }
+
+  bool holds(uint64_t value, uint64_t fp) const {
+    uint64_t x = value ^ (fp * lanesLow);
+    return ((x - lanesLow) & ~x & lanesHigh) != 0;
+  }
+
+  uint64_t get(size_t index, size_t slot) const {
+    return (bucket(index) >> (slot * bits)) & fingerprintMask;
+  }
+
+  void set(size_t index, size_t slot, uint64_t fp) {
+    uint64_t value = bucket(index);
+    value &= ~(fingerprintMask << (slot * bits));
+    store(index, value | fp << (slot * bits));
+  }
+
+  // Put fp in a free slot of the bucket, false if there is none.
+  bool put(size_t index, uint64_t fp) {
+    for (size_t slot = 0; slot < SLOTS; ++slot) {
+      if (get(index, slot) == 0) {
+        set(index, slot, fp);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Clear a slot holding fp, false if there is none.
+  bool take(size_t index, uint64_t fp) {
+    for (size_t slot = 0; slot < SLOTS; ++slot) {
+      if (get(index, slot) == fp) {
+        set(index, slot, 0);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // xorshift64, picks the slot to kick out.
+  uint64_t nextRandom() {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+  }
+};
+
+// A hash table behind a cuckoo filter. A lookup of a key the filter has not
+// seen is answered by the filter alone, without touching the table, and
+// the others by the table. The filter follows the inserts and removes of the
+// table, and is rebuilt twice as large from the keys of the table once it
+// fills up.
+// Table is ChainedHashTable, OpenHashTable or anything with their
+// constructor (size first), bool insert / remove, contains and forEach.
+template <typename Key, typename Table = ChainedHashTable<Key>,
+          typename Filter = CuckooFilter<Key>>
+class FilteredHashTable {
+ public:
+  explicit FilteredHashTable(size_t size = 16,
+                             double falsePositiveRate = 0.01)
+      : table(size),
+        filter(size, falsePositiveRate),
+        falsePositiveRate(falsePositiveRate) {}
+
+  // Returns false if the key is already in the table.
+  bool insert(const Key &key) {
+    if (!table.insert(key)) {
+      return false;
+    }
+    if (!filter.insert(key) || filter.full()) {
+      rebuildFilter(filter.capacity() * 2);
+    }
+    return true;
+  }
+
+  // Returns false if the key is not in the table.
+  bool remove(const Key &key) {
+    if (!table.remove(key)) {
+      return false;
+    }
+    filter.remove(key);
+    return true;
+  }
+
+  bool contains(const Key &key) {
+    return filter.mayContain(key) && table.contains(key);
+  }
+
+  size_t size() const { return table.size(); }
+
+  Table &base() { return table; }
+
+  const Filter &front() const { return filter; }
+
+ private:
+  Table table;
+  Filter filter;
+  double falsePositiveRate;
+
+  void rebuildFilter(size_t capacity) {
+    while (true) {
+      Filter bigger(capacity, falsePositiveRate);
+      bool placed = true;
+      table.forEach([&](const Key &key) {
+        placed = placed && bigger.insert(key) && !bigger.full();
+      });
+      if (placed) {
+        filter = std::move(bigger);
+        return;
+      }
+      capacity *= 2;
+    }
+  }
+};
+
+}  // namespace haomi
+
+#endif
+
+// Test code, 10M random ints inserted, looked up (half of them missing) and
+// removed, the chained HashTable of hw9 against OpenHashTable and
+// std::unordered_set.
+// #include <ctime>
+// #include <list>
+// #include <unordered_set>
+// #include <vector>
+//
+// // The HashTable of hw9/i.cpp, with the printing left out.
+// class HashTable {
+//  public:
+//   HashTable(int size) : TABLE_SIZE(size), table(size) {}
+//   int hashFunc(int key) const { return key % TABLE_SIZE; }
+//   void insert(int key) {
+//     int idx = hashFunc(key);
+//     for (int x : table[idx]) {
+//       if (x == key) return;
+//     }
+//     table[idx].push_back(key);
+//     ++numElements;
+//   }
+//   void remove(int key) {
+//     auto &chain = table[hashFunc(key)];
+//     for (auto it = chain.begin(); it != chain.end(); ++it) {
+//       if (*it == key) {
+//         chain.erase(it);
+//         --numElements;
+//         return;
+//       }
+//     }
+//   }
+//   bool contains(int key) const {
+//     for (int x : table[hashFunc(key)]) {
+//       if (x == key) return true;
+//     }
+//     return false;
+//   }
+//
+//  private:
+//   int TABLE_SIZE;
+//   int numElements = 0;
+//   std::vector<std::list<int>> table;
+// };
+//
+// template <typename Table, typename Insert, typename Contains,
+//           typename Remove>
+// void bench(const char *name, Table &table, const std::vector<int> &keys,
+//            Insert insert, Contains contains, Remove remove) {
+//   clock_t begin = clock();
+//   for (int key : keys) insert(table, key);
+//   double insertTime = (double)(clock() - begin) / CLOCKS_PER_SEC;
+//   size_t hit = 0;
+//   begin = clock();
+//   for (int key : keys) {
+//     hit += contains(table, key) + contains(table, key ^ 0x40000000);
+//   }
+//   double findTime = (double)(clock() - begin) / CLOCKS_PER_SEC;
+//   begin = clock();
+//   for (int key : keys) remove(table, key);
+//   double removeTime = (double)(clock() - begin) / CLOCKS_PER_SEC;
+//   std::cout << name << ": insert " << insertTime << "s, find " << findTime
+//             << "s, remove " << removeTime << "s, " << hit << " hits\n";
+// }
+//
+// int main() {
+//   const int N = 10000000;
+//   std::vector<int> keys(N);
+//   unsigned x = 1;
+//   for (int &key : keys) {
+//     x = x * 1103515245 + 12345;
+//     key = (int)(x >> 1);
+//   }
+//
+//   // Chained with a load factor of 1, it does not grow.
+//   HashTable chained(N);
+//   bench("chained", chained, keys, [](HashTable &t, int k) { t.insert(k); },
+//         [](HashTable &t, int k) { return t.contains(k); },
+//         [](HashTable &t, int k) { t.remove(k); });
+//
+//   haomi::OpenHashTable<int> open;
+//   bench("open", open, keys,
+//         [](haomi::OpenHashTable<int> &t, int k) { t.insert(k); },
+//         [](haomi::OpenHashTable<int> &t, int k) { return t.contains(k); },
+//         [](haomi::OpenHashTable<int> &t, int k) { t.remove(k); });
+//
+//   std::unordered_set<int> stl;
+//   bench("unordered_set", stl, keys,
+//         [](std::unordered_set<int> &t, int k) { t.insert(k); },
+//         [](std::unordered_set<int> &t, int k) { return t.count(k) != 0; },
+//         [](std::unordered_set<int> &t, int k) { t.erase(k); });
+//
+//   haomi::OpenHashTable<int> stats;
+//   for (int i = 0; i < N; ++i) stats.insert(keys[i]);
+//   std::cout << "ASL1 " << stats.ASL1() << ", ASL2 " << stats.ASL2()
+//             << ", load factor " << stats.loadFactor() << "\n";
+// }
+
+// Test code, insert latency while growing to 20M keys, incremental rehashing
+// against moving all the buckets at once (migrateStep = SIZE_MAX). Both
+// tables are kept until the end, releasing 20M nodes leaves the allocator
+// a long consolidation to do on the next large request.
+// #include <algorithm>
+// #include <cassert>
+// #include <chrono>
+// #include <vector>
+//
+// void run(haomi::ChainedHashTable<int> &table, const char *name) {
+//   const size_t N = 20000000;
+//   std::vector<uint32_t> latency(N);
+//   unsigned x = 1;
+//   for (size_t i = 0; i < N; ++i) {
+//     x = x * 1103515245 + 12345;
+//     auto begin = std::chrono::steady_clock::now();
+//     table.insert((int)x);
+//     auto end = std::chrono::steady_clock::now();
+//     latency[i] = (uint32_t)std::chrono::duration_cast<
+//                      std::chrono::nanoseconds>(end - begin)
+//                      .count();
+//   }
+//   std::sort(latency.begin(), latency.end());
+//   std::cout << name << ": p50 " << latency[N / 2] << "ns, p99.9 "
+//             << latency[N - N / 1000] << "ns, p99.99 "
+//             << latency[N - N / 10000] << "ns, max " << latency[N - 1]
+//             << "ns\n";
+// }
+//
+// int main() {
+//   {
+//     // Destroyed half way through a rehash, the moved chains must be freed
+//     // once (run with -fsanitize=address).
+//     haomi::ChainedHashTable<int> table(8, 1.0, 1);
+//     for (int i = 0; i < 9; ++i) table.insert(i);
+//     table.contains(0), table.contains(1);
+//     assert(table.isRehashing());
+//   }
+//   haomi::ChainedHashTable<int> stopTheWorld(16, 1.0, SIZE_MAX);
+//   haomi::ChainedHashTable<int> incremental(16, 1.0, 8);
+//   run(stopTheWorld, "stop the world");
+//   run(incremental, "incremental");
+// }
+
+// Test code, ConcurrentHashSet throughput with 1 to 32 threads, 95% and 50%
+// lookups, the rest inserts and removes in equal parts, over 2M keys of
+// which about half are in the set.
+// #include <chrono>
+// #include <vector>
+//
+// int main() {
+//   const int KEYS = 2000000, OPS = 2000000;
+//   for (int readPercent : {95, 50}) {
+//     for (int threads = 1; threads <= 32; threads *= 2) {
+//       haomi::ConcurrentHashSet<int> set;
+//       for (int key = 0; key < KEYS; key += 2) set.insert(key);
+//       std::vector<std::thread> workers;
+//       auto begin = std::chrono::steady_clock::now();
+//       for (int t = 0; t < threads; ++t) {
+//         workers.emplace_back([&set, t, readPercent] {
+//           unsigned x = t + 1;
+//           for (int i = 0; i < OPS; ++i) {
+//             x = x * 1103515245 + 12345;
+//             int key = (int)((x >> 1) % KEYS), op = (int)(x >> 24) % 100;
+//             if (op < readPercent) {
+//               set.contains(key);
+//             } else if (op % 2) {
+//               set.insert(key);
+//             } else {
+//               set.remove(key);
+//             }
+//           }
+//         });
+//       }
+//       for (auto &worker : workers) worker.join();
+//       std::chrono::duration<double> time =
+//           std::chrono::steady_clock::now() - begin;
+//       std::cout << readPercent << "/" << 100 - readPercent << ", "
+//                 << threads << " threads: "
+//                 << threads * (OPS / 1e6) / time.count() << " Mops/s\n";
+//     }
+//   }
+// }
+
+// Test code, the four hash functions on the same key streams (random keys,
+// and keys with a stride of 4096 as produced by aligned addresses), then the
+// load factor and the longest probe of an OpenHashTable sampled while it
+// grows to 8M keys.
+// #include <vector>
+//
+// template <typename Hash>
+// void compare(const char *name, const std::vector<uint64_t> &keys,
+//              Hash hash) {
+//   haomi::HashTableStats chained = haomi::chainedDistribution(
+//       keys.begin(), keys.end(), hash, keys.size());
+//   haomi::HashTableStats open = haomi::openDistribution(
+//       keys.begin(), keys.end(), hash, keys.size() * 2);
+//   std::cout << "  " << name << ": chained max " << chained.maxProbe
+//             << " ASL1 " << chained.ASL1 << ", open max " << open.maxProbe
+//             << " ASL1 " << open.ASL1 << "\n";
+// }
+//
+// int main() {
+//   const size_t N = 1 << 20;
+//   std::vector<uint64_t> random(N), strided(N);
+//   unsigned x = 1;
+//   for (size_t i = 0; i < N; ++i) {
+//     x = x * 1103515245 + 12345;
+//     random[i] = (uint64_t)x << 16 | i;
+//     strided[i] = i * 4096;
+//   }
+//   for (auto *keys : {&random, &strided}) {
+//     std::cout << (keys == &random ? "random" : "stride 4096") << ":\n";
+//     compare("identity", *keys, haomi::IdentityHash());
+//     compare("multiply shift", *keys, haomi::MultiplyShiftHash());
+//     compare("murmur", *keys, haomi::MurmurMix());
+//     compare("xxhash", *keys, haomi::XxhMix());
+//   }
+//
+//   haomi::OpenHashTable<uint64_t> table;
+//   for (size_t i = 1; i <= 8 * N; ++i) {
+//     x = x * 1103515245 + 12345;
+//     table.insert((uint64_t)x << 24 | i);
+//     if (i % N == 0) {
+//       haomi::HashTableStats stats = table.stats();
+//       std::cout << i << " keys: load factor " << stats.loadFactor
+//                 << ", max probe " << stats.maxProbe << "\n";
+//     }
+//   }
+//   table.stats().print();
+// }
+
+// Test code, lookups of which 90% and 99% miss, among 1M and 10M ints in
+// the chained HashTable of hw9 (bucket count N, division hash), alone and
+// behind cuckoo filters of 1% and 0.1%, with the measured false positive
+// rate. A miss costs the filter two cache misses where the table takes one
+// or two, and a hit pays for both, so the filter pays off only when nearly
+// every lookup misses: with 99% misses it is 1.1 to 1.7 times as fast as the
+// table alone, with 90% it is slower.
+// #include <cassert>
+// #include <chrono>
+// #include <list>
+// #include <vector>
+//
+// // The HashTable of hw9/i.cpp, with what FilteredHashTable asks of a table.
+// class HashTable {
+//  public:
+//   HashTable(size_t size) : TABLE_SIZE((int)size), table(size) {}
+//   int hashFunc(int key) const { return key % TABLE_SIZE; }
+//   bool insert(int key) {
+//     int idx = hashFunc(key);
+//     for (int x : table[idx]) {
+//       if (x == key) return false;
+//     }
+//     table[idx].push_back(key);
+//     ++numElements;
+//     return true;
+//   }
+//   bool remove(int key) {
+//     auto &chain = table[hashFunc(key)];
+//     for (auto it = chain.begin(); it != chain.end(); ++it) {
+//       if (*it == key) {
+//         chain.erase(it);
+//         --numElements;
+//         return true;
+//       }
+//     }
+//     return false;
+//   }
+//   bool contains(int key) const {
+//     for (int x : table[hashFunc(key)]) {
+//       if (x == key) return true;
+//     }
+//     return false;
+//   }
+//   size_t size() const { return numElements; }
+//   template <typename Func>
+//   void forEach(Func &&func) const {
+//     for (const auto &chain : table) {
+//       for (int x : chain) func(x);
+//     }
+//   }
+//
+//  private:
+//   int TABLE_SIZE;
+//   int numElements = 0;
+//   std::vector<std::list<int>> table;
+// };
+//
+// template <typename Table>
+// void bench(const char *name, Table &table,
+//            const std::vector<std::vector<int>> &queries) {
+//   std::cout << name << ":";
+//   for (const auto &query : queries) {
+//     size_t hit = 0;
+//     auto begin = std::chrono::steady_clock::now();
+//     for (int key : query) hit += table.contains(key);
+//     std::chrono::duration<double> time =
+//         std::chrono::steady_clock::now() - begin;
+//     std::cout << " " << query.size() / time.count() / 1e6 << " M/s ("
+//               << hit << " hits)";
+//   }
+//   std::cout << "\n";
+// }
+//
+// int main() {
+//   {
+//     // The default ChainedHashTable destroyed half way through a rehash
+//     // (run with -fsanitize=address).
+//     haomi::FilteredHashTable<int> filtered;
+//     int i = 0;
+//     while (!filtered.base().isRehashing()) filtered.insert(i++);
+//     assert(filtered.contains(0) && !filtered.contains(i));
+//   }
+//   for (int N : {1000000, 10000000}) {
+//     std::vector<int> keys(N);
+//     std::vector<std::vector<int>> queries(2, std::vector<int>(N));
+//     unsigned x = 1;
+//     for (int &key : keys) {
+//       x = x * 1103515245 + 12345;
+//       key = (int)(x >> 2);
+//     }
+//     for (int i = 0; i < N; ++i) {
+//       x = x * 1103515245 + 12345;
+//       int key = keys[(x >> 4) % N];
+//       queries[0][i] = (x >> 8) % 10 ? key | 0x40000000 : key;
+//       queries[1][i] = (x >> 8) % 100 ? key | 0x40000000 : key;
+//     }
+//
+//     std::cout << N << " keys\n";
+//     HashTable plain(N);
+//     for (int key : keys) plain.insert(key);
+//     bench("hw9 HashTable", plain, queries);
+//     for (double rate : {0.01, 0.001}) {
+//       haomi::FilteredHashTable<int, HashTable> filtered(N, rate);
+//       for (int key : keys) filtered.insert(key);
+//       size_t falsePositives = 0;
+//       for (int key : queries[1]) {
+//         falsePositives += filtered.front().mayContain(key) &&
+//                           !filtered.base().contains(key);
+//       }
+//       std::cout << "filter of " << filtered.front().fingerprintBits()
+//                 << " bit fingerprints, "
+//                 << filtered.front().sizeInBytes() / 1024 << " KB, "
+//                 << "false positive rate "
+//                 << (double)falsePositives / N << "\n";
+//       bench("  behind it", filtered, queries);
+//     }
+//   }
+// }
@@ -144,34 +144,95 @@ void _free_empty_circular_linked_list_(circular_linked_list *list_ptr) {
 }
 
 
-void list_sort(intrusive_node *begin , intrusive_node *end, int(*cmp)(const intrusive_node *, const intrusive_node *)) {
-  intrusive_node *edge = malloc(sizeof(intrusive_node));
-  edge->prev = end->prev;
-  edge->next = end;
-  edge->prev->next = edge;
-  edge->next->prev = edge;
-
-  while (edge->prev != begin) {
-    intrusive_node *to_proc = edge->prev;
-    to_proc->next->prev = to_proc->prev;
-    to_proc->prev->next = to_proc->next;
-
-    intrusive_node *to_cmp = edge->next;
-    for (; to_cmp != end; to_cmp = to_cmp->next) {
-      if (cmp(to_cmp, to_proc) > 0) {
-        break;
-      }
+// Merge two runs linked by next and ended by NULL. Ties are taken from a, the
+// run in front, so the sort is stable.
+static intrusive_node *_merge_runs(intrusive_node *a, intrusive_node *b,
+                                   int (*cmp)(const intrusive_node *a,
+                                              const intrusive_node *b)) {
+  intrusive_node head, *tail = &head;
+  while (a && b) {
+    if (cmp(a, b) > 0) {
+      tail->next = b, tail = b, b = b->next;
+    } else {
+      tail->next = a, tail = a, a = a->next;
     }
-    // Insert the to_proc in front of to_cmp
-    to_proc->next = to_cmp;
-    to_proc->prev = to_cmp->prev;
-    to_proc->next->prev = to_proc;
-    to_proc->prev->next = to_proc;
+  }
+  tail->next = a ? a : b;
+  return head.next;
+}
+
+// Cut the run at the front of *rest off. A non decreasing run is taken as it
+// is and a strictly decreasing one is reversed, equal nodes never swap.
+static intrusive_node *_take_run(intrusive_node **rest,
+                                 int (*cmp)(const intrusive_node *a,
+                                            const intrusive_node *b)) {
+  intrusive_node *run = *rest, *next = run->next;
+  if (next && cmp(run, next) > 0) {
+    run->next = NULL;
+    do {
+      intrusive_node *after = next->next;
+      next->next = run;
+      run = next;
+      next = after;
+    } while (next && cmp(run, next) > 0);
+  } else if (next) {
+    intrusive_node *tail = next;
+    next = next->next;
+    while (next && cmp(tail, next) <= 0) {
+      tail = next;
+      next = next->next;
+    }
+    tail->next = NULL;
+  }
+  *rest = next;
+  return run;
+}
+
+// Begin and end does not store information, they may be the same node (the
+// head of a circular list).
+// Bottom up natural merge sort: the runs already in the list are merged like
+// the digits of a binary counter, pending[k] holding the merge of 2^k runs,
+// so every node goes through at most log2(runs) + 1 merges and a sorted list
+// costs n - 1 compares. Stable, no allocation, the prev links are only set
+// again at the end.
+void list_sort(intrusive_node *begin, intrusive_node *end,
+               int (*cmp)(const intrusive_node *, const intrusive_node *)) {
+  if (begin->next == end || begin->next->next == end) {
+    return;
   }
 
-  edge->prev->next = edge->next;
-  edge->next->prev = edge->prev;
-  free(edge);
+  intrusive_node *pending[64] = {NULL}, *rest = begin->next;
+  end->prev->next = NULL;
+  size_t top = 0;
+  while (rest) {
+    intrusive_node *carry = _take_run(&rest, cmp);
+    size_t k = 0;
+    for (; pending[k]; k++) {
+      // pending[k] comes first in the list.
+      carry = _merge_runs(pending[k], carry, cmp);
+      pending[k] = NULL;
+    }
+    pending[k] = carry;
+    if (k >= top) {
+      top = k + 1;
+    }
+  }
+
+  intrusive_node *sorted = NULL;
+  for (size_t k = 0; k < top; k++) {
+    if (pending[k]) {
+      sorted = sorted ? _merge_runs(pending[k], sorted, cmp) : pending[k];
+    }
+  }
+
+  intrusive_node *prev = begin;
+  begin->next = sorted;
+  for (intrusive_node *it = sorted; it; it = it->next) {
+    it->prev = prev;
+    prev = it;
+  }
+  prev->next = end;
+  end->prev = prev;
 }
 
 
@@ -143,77 +143,96 @@ void _free_empty_circular_linked_list_(circular_linked_list *list_ptr) {
   list_ptr->head = NULL;
 }
 
-// Begin and end does not store information.
+// Merge two runs linked by next and ended by NULL. Ties are taken from a, the
+// run in front, so the sort is stable.
+static intrusive_node *_merge_runs(intrusive_node *a, intrusive_node *b,
+                                   int (*cmp)(const intrusive_node *a,
+                                              const intrusive_node *b)) {
+  intrusive_node head, *tail = &head;
+  while (a && b) {
+    if (cmp(a, b) > 0) {
+      tail->next = b, tail = b, b = b->next;
+    } else {
+      tail->next = a, tail = a, a = a->next;
+    }
+  }
+  tail->next = a ? a : b;
+  return head.next;
+}
+
+// Cut the run at the front of *rest off. A non decreasing run is taken as it
+// is and a strictly decreasing one is reversed, equal nodes never swap.
+static intrusive_node *_take_run(intrusive_node **rest,
+                                 int (*cmp)(const intrusive_node *a,
+                                            const intrusive_node *b)) {
+  intrusive_node *run = *rest, *next = run->next;
+  if (next && cmp(run, next) > 0) {
+    run->next = NULL;
+    do {
+      intrusive_node *after = next->next;
+      next->next = run;
+      run = next;
+      next = after;
+    } while (next && cmp(run, next) > 0);
+  } else if (next) {
+    intrusive_node *tail = next;
+    next = next->next;
+    while (next && cmp(tail, next) <= 0) {
+      tail = next;
+      next = next->next;
+    }
+    tail->next = NULL;
+  }
+  *rest = next;
+  return run;
+}
+
+// Begin and end does not store information, they may be the same node (the
+// head of a circular list).
+// Bottom up natural merge sort: the runs already in the list are merged like
+// the digits of a binary counter, pending[k] holding the merge of 2^k runs,
+// so every node goes through at most log2(runs) + 1 merges and a sorted list
+// costs n - 1 compares. Stable, no allocation, the prev links are only set
+// again at the end.
 void linked_list_sort(intrusive_node *begin, intrusive_node *end,
                       int (*cmp)(const intrusive_node *a,
                                  const intrusive_node *b)) {
-  if (begin->next == end) {
+  if (begin->next == end || begin->next->next == end) {
     return;
   }
 
-  size_t list_len = 0;
-  for (intrusive_node *it = begin->next; it != end; it = it->next) {
-    list_len++;
-  }
-  if (list_len == 1) {
-    return;
+  intrusive_node *pending[64] = {NULL}, *rest = begin->next;
+  end->prev->next = NULL;
+  size_t top = 0;
+  while (rest) {
+    intrusive_node *carry = _take_run(&rest, cmp);
+    size_t k = 0;
+    for (; pending[k]; k++) {
+      // pending[k] comes first in the list.
+      carry = _merge_runs(pending[k], carry, cmp);
+      pending[k] = NULL;
+    }
+    pending[k] = carry;
+    if (k >= top) {
+      top = k + 1;
+    }
   }
 
-  size_t front_len = list_len / 2, back_len = list_len - (list_len / 2);
-  // Insert the guard node to the middle of the list.
-  intrusive_node guard_node, *iter = begin;
-  for (size_t i = 0; i < front_len; i++) {
-    iter = iter->next;
-  }
-  // Insert node to the back of the iterator.
-  guard_node.next = iter->next, guard_node.prev = iter,
-  iter->next->prev = &guard_node, iter->next = &guard_node;
-
-  linked_list_sort(begin, &guard_node, cmp);
-  linked_list_sort(&guard_node, end, cmp);
-
-  intrusive_node new_begin, new_end;
-  new_begin.prev = NULL, new_end.next = NULL, new_begin.next = &new_end,
-  new_end.prev = &new_begin;
-  intrusive_node *front_it = begin->next, *back_it = guard_node.next;
-
-  while (front_it != &guard_node && back_it != end) {
-    if (cmp(front_it, back_it) > 0) {
-      intrusive_node *node_to_move = back_it;
-      back_it = back_it->next;
-      node_to_move->next = &new_end;
-      node_to_move->prev = new_end.prev;
-      new_end.prev->next = node_to_move;
-      new_end.prev = node_to_move;
-    } else {
-      intrusive_node *node_to_move = front_it;
-      front_it = front_it->next;
-      node_to_move->next = &new_end;
-      node_to_move->prev = new_end.prev;
-      new_end.prev->next = node_to_move;
-      new_end.prev = node_to_move;
+  intrusive_node *sorted = NULL;
+  for (size_t k = 0; k < top; k++) {
+    if (pending[k]) {
+      sorted = sorted ? _merge_runs(pending[k], sorted, cmp) : pending[k];
     }
   }
 
-  while (front_it != &guard_node) {
-    intrusive_node *node_to_move = front_it;
-    front_it = front_it->next;
-    node_to_move->next = &new_end;
-    node_to_move->prev = new_end.prev;
-    new_end.prev->next = node_to_move;
-    new_end.prev = node_to_move;
-  }
-  while (back_it != end) {
-    intrusive_node *node_to_move = back_it;
-    back_it = back_it->next;
-    node_to_move->next = &new_end;
-    node_to_move->prev = new_end.prev;
-    new_end.prev->next = node_to_move;
-    new_end.prev = node_to_move;
+  intrusive_node *prev = begin;
+  begin->next = sorted;
+  for (intrusive_node *it = sorted; it; it = it->next) {
+    it->prev = prev;
+    prev = it;
   }
-
-  new_begin.next->prev = begin, new_end.prev->next = end;
-  begin->next = new_begin.next, end->prev = new_end.prev;
+  prev->next = end;
+  end->prev = prev;
 }
 
 // Test code ...
@@ -250,6 +269,59 @@ int char_node_cmp(const intrusive_node *node1, const intrusive_node *node2) {
 //   putchar('\n');
 // }
 
+// Test code, linked_list_sort on 1M and 10M int nodes in random, sorted and
+// reverse sorted order, time and compares. The nodes are allocated in list
+// order, shuffled ones would mostly time cache misses.
+// #include <time.h>
+//
+// typedef struct int_node {
+//   int dat;
+//   intrusive_node node;
+// } int_node;
+//
+// static size_t compares;
+//
+// int int_node_cmp(const intrusive_node *node1, const intrusive_node *node2) {
+//   int a = CONTAINER_OF(int_node, node, node1)->dat,
+//       b = CONTAINER_OF(int_node, node, node2)->dat;
+//   compares++;
+//   return (a > b) - (a < b);
+// }
+//
+// int main(void) {
+//   const char *names[] = {"random", "sorted", "reverse"};
+//   for (size_t n = 1000000; n <= 10000000; n *= 10) {
+//     int_node *nodes = malloc(n * sizeof(int_node));
+//     for (int order = 0; order < 3; order++) {
+//       doubly_linked_list lst;
+//       INIT_LINKED_LIST(doubly_linked_list, &lst);
+//       unsigned x = 1;
+//       for (size_t i = 0; i < n; i++) {
+//         x = x * 1103515245 + 12345;
+//         nodes[i].dat = order == 0 ? (int)(x >> 1)
+//                        : order == 1 ? (int)i
+//                                     : (int)(n - i);
+//         INSERT_IN_FRONT_OF(&lst, lst.tail, &nodes[i].node);
+//       }
+//       compares = 0;
+//       clock_t begin = clock();
+//       linked_list_sort(lst.head, lst.tail, int_node_cmp);
+//       double time = (double)(clock() - begin) / CLOCKS_PER_SEC;
+//       int last = -1;
+//       for (intrusive_node *it = lst.head->next; it != lst.tail;
+//            it = it->next) {
+//         assert(CONTAINER_OF(int_node, node, it)->dat >= last);
+//         last = CONTAINER_OF(int_node, node, it)->dat;
+//       }
+//       printf("%zu %s: %.3fs, %zu compares\n", n, names[order], time,
+//              compares);
+//       free(lst.head);
+//       free(lst.tail);
+//     }
+//     free(nodes);
+//   }
+// }
+
 // int main() {
 //   doubly_linked_list dlist;
 //   INIT_LINKED_LIST(doubly_linked_list, &dlist);
@@ -337,3 +409,868 @@ intrusive_node *linked_queue_pop(linked_queue *queue) {
 //     free(CONTAINER_OF(char_node, node, node));
 //   }
 // }
+
+// Unrolled linked list.
+// Elements of element_size bytes are kept by value, up to block_capacity of
+// them in each block, and the blocks are linked in a doubly_linked_list, so a
+// traversal takes one cache miss per block instead of one per element.
+// A full block is split in two halves on insert, except at its end where a
+// new block is started, so pushing at the back leaves full blocks. A block
+// falling under half full on erase takes elements from a neighbour, or is
+// merged with it when both fit in one block.
+// An iterator is a block and a position in it, the end iterator has the tail
+// of the block list as its block. Insert and erase invalidate the other
+// iterators of the list.
+
+typedef struct unrolled_block {
+  intrusive_node node;
+  size_t count;
+  // block_capacity elements follow.
+} unrolled_block;
+
+#define _UNROLLED_BLOCK(NODE_PTR) CONTAINER_OF(unrolled_block, node, NODE_PTR)
+
+#define _UNROLLED_AT(LIST_PTR, BLOCK_PTR, POS) \
+  ((char *)((BLOCK_PTR) + 1) + (POS) * (LIST_PTR)->element_size)
+
+typedef struct unrolled_list {
+  doubly_linked_list blocks;
+  size_t element_size;
+  size_t block_capacity;
+  size_t size;
+} unrolled_list;
+
+typedef struct unrolled_iterator {
+  intrusive_node *block;
+  size_t pos;
+} unrolled_iterator;
+
+#define UNROLLED_GET(ELEMENT_TYPE, LIST_PTR, ITER) \
+  (*(ELEMENT_TYPE *)unrolled_iterator_get(LIST_PTR, ITER))
+
+void init_unrolled_list(unrolled_list *list, size_t element_size,
+                        size_t block_capacity) {
+  INIT_LINKED_LIST(doubly_linked_list, &list->blocks);
+  list->element_size = element_size;
+  list->block_capacity = block_capacity ? block_capacity : 1;
+  list->size = 0;
+}
+
+void destroy_unrolled_list(unrolled_list *list) {
+  DESTROY_LIST(unrolled_block, node, doubly_linked_list, &list->blocks);
+  list->size = 0;
+}
+
+unrolled_iterator unrolled_list_begin(const unrolled_list *list) {
+  unrolled_iterator it = {list->blocks.head->next, 0};
+  return it;
+}
+
+unrolled_iterator unrolled_list_end(const unrolled_list *list) {
+  unrolled_iterator it = {list->blocks.tail, 0};
+  return it;
+}
+
+bool unrolled_iterator_equal(unrolled_iterator a, unrolled_iterator b) {
+  return a.block == b.block && a.pos == b.pos;
+}
+
+void *unrolled_iterator_get(const unrolled_list *list, unrolled_iterator it) {
+  return _UNROLLED_AT(list, _UNROLLED_BLOCK(it.block), it.pos);
+}
+
+unrolled_iterator unrolled_iterator_next(unrolled_iterator it) {
+  if (++it.pos == _UNROLLED_BLOCK(it.block)->count) {
+    it.block = it.block->next;
+    it.pos = 0;
+  }
+  return it;
+}
+
+unrolled_iterator unrolled_iterator_prev(unrolled_iterator it) {
+  if (it.pos == 0) {
+    it.block = it.block->prev;
+    it.pos = _UNROLLED_BLOCK(it.block)->count;
+  }
+  it.pos--;
+  return it;
+}
+
+static unrolled_block *_new_unrolled_block(unrolled_list *list,
+                                           intrusive_node *behind) {
+  unrolled_block *block = (unrolled_block *)malloc(
+      sizeof(unrolled_block) + list->block_capacity * list->element_size);
+  if (block == NULL) {
+    perror("Allocate unrolled block failed!");
+    return NULL;
+  }
+  block->count = 0;
+  INSERT_BEHIND(&list->blocks, behind, &block->node);
+  return block;
+}
+
+static void _release_unrolled_block(unrolled_list *list,
+                                    unrolled_block *block) {
+  REMOVE_AND_RELEASE(unrolled_block, node, &list->blocks, &block->node);
+}
+
+// Insert a copy of element in front of *it, which then points to the new
+// element. Returns 0, or -2 if a block could not be allocated.
+int unrolled_list_insert(unrolled_list *list, unrolled_iterator *it,
+                         const void *element) {
+  unrolled_block *block;
+  size_t pos = it->pos;
+  if (it->block == list->blocks.tail) {
+    // At the end, behind the last element of the last block.
+    if (list->blocks.size == 0) {
+      block = _new_unrolled_block(list, list->blocks.head);
+      if (block == NULL) {
+        return -2;
+      }
+    } else {
+      block = _UNROLLED_BLOCK(list->blocks.tail->prev);
+    }
+    pos = block->count;
+  } else {
+    block = _UNROLLED_BLOCK(it->block);
+  }
+
+  size_t cap = list->block_capacity, size = list->element_size;
+  if (block->count == cap) {
+    unrolled_block *next = _new_unrolled_block(list, &block->node);
+    if (next == NULL) {
+      return -2;
+    }
+    if (pos == cap) {
+      block = next;
+      pos = 0;
+    } else {
+      size_t half = cap / 2;
+      memcpy(_UNROLLED_AT(list, next, 0), _UNROLLED_AT(list, block, half),
+             (cap - half) * size);
+      next->count = cap - half;
+      block->count = half;
+      if (pos > half) {
+        block = next;
+        pos -= half;
+      }
+    }
+  }
+
+  memmove(_UNROLLED_AT(list, block, pos + 1), _UNROLLED_AT(list, block, pos),
+          (block->count - pos) * size);
+  memcpy(_UNROLLED_AT(list, block, pos), element, size);
+  block->count++;
+  list->size++;
+  it->block = &block->node;
+  it->pos = pos;
+  return 0;
+}
+
+int unrolled_list_push_back(unrolled_list *list, const void *element) {
+  unrolled_iterator it = unrolled_list_end(list);
+  return unrolled_list_insert(list, &it, element);
+}
+
+// Erase the element at it, returns the iterator of the element behind it.
+unrolled_iterator unrolled_list_erase(unrolled_list *list,
+                                      unrolled_iterator it) {
+  unrolled_block *block = _UNROLLED_BLOCK(it.block);
+  size_t cap = list->block_capacity, size = list->element_size;
+  memmove(_UNROLLED_AT(list, block, it.pos),
+          _UNROLLED_AT(list, block, it.pos + 1),
+          (block->count - it.pos - 1) * size);
+  block->count--;
+  list->size--;
+  if (it.pos == block->count) {
+    it.block = it.block->next;
+    it.pos = 0;
+  }
+
+  if (block->count == 0) {
+    _release_unrolled_block(list, block);
+    return it;
+  }
+  if (block->count >= cap / 2) {
+    return it;
+  }
+
+  if (block->node.next != list->blocks.tail) {
+    // Take from the next block, all of it if it fits.
+    unrolled_block *next = _UNROLLED_BLOCK(block->node.next);
+    size_t moved = block->count + next->count <= cap
+                       ? next->count
+                       : (next->count - block->count) / 2;
+    memcpy(_UNROLLED_AT(list, block, block->count),
+           _UNROLLED_AT(list, next, 0), moved * size);
+    memmove(_UNROLLED_AT(list, next, 0), _UNROLLED_AT(list, next, moved),
+            (next->count - moved) * size);
+    if (it.block == &next->node) {
+      // it was the first element of next, now moved or still first.
+      it.block = &block->node;
+      it.pos = block->count;
+    }
+    block->count += moved;
+    next->count -= moved;
+    if (next->count == 0) {
+      _release_unrolled_block(list, next);
+    }
+  } else if (block->node.prev != list->blocks.head) {
+    // The last block, take from the previous one.
+    unrolled_block *prev = _UNROLLED_BLOCK(block->node.prev);
+    if (prev->count + block->count <= cap) {
+      memcpy(_UNROLLED_AT(list, prev, prev->count),
+             _UNROLLED_AT(list, block, 0), block->count * size);
+      if (it.block == &block->node) {
+        it.block = &prev->node;
+        it.pos += prev->count;
+      }
+      prev->count += block->count;
+      block->count = 0;
+      _release_unrolled_block(list, block);
+    } else {
+      size_t moved = (prev->count - block->count) / 2;
+      memmove(_UNROLLED_AT(list, block, moved), _UNROLLED_AT(list, block, 0),
+              block->count * size);
+      memcpy(_UNROLLED_AT(list, block, 0),
+             _UNROLLED_AT(list, prev, prev->count - moved), moved * size);
+      if (it.block == &block->node) {
+        it.pos += moved;
+      }
+      block->count += moved;
+      prev->count -= moved;
+    }
+  }
+  return it;
+}
+
+// Test code, 10M ints in an unrolled list of 64 ints a block against a
+// doubly_linked_list of int nodes: push back, sum, insert one behind every
+// other element, sum, erase every third element, sum. The list nodes
+// inserted in the middle come from the allocator in insertion order, so the
+// later sums follow pointers all over the heap.
+// #include <time.h>
+//
+// typedef struct int_node {
+//   int dat;
+//   intrusive_node node;
+// } int_node;
+//
+// static clock_t lap_begin;
+//
+// void lap(const char *name, long long sum) {
+//   printf("  %s: %.3fs (%lld)\n", name,
+//          (double)(clock() - lap_begin) / CLOCKS_PER_SEC, sum);
+//   lap_begin = clock();
+// }
+//
+// int main(void) {
+//   const int N = 10000000;
+//   long long sum;
+//
+//   printf("unrolled:\n");
+//   lap_begin = clock();
+//   unrolled_list ul;
+//   init_unrolled_list(&ul, sizeof(int), 64);
+//   for (int i = 0; i < N; i++) unrolled_list_push_back(&ul, &i);
+//   lap("push back", ul.size);
+//   for (int pass = 0; pass < 3; pass++) {
+//     sum = 0;
+//     for (unrolled_iterator it = unrolled_list_begin(&ul);
+//          !unrolled_iterator_equal(it, unrolled_list_end(&ul));
+//          it = unrolled_iterator_next(it)) {
+//       sum += UNROLLED_GET(int, &ul, it);
+//     }
+//     lap("sum", sum);
+//     unrolled_iterator it = unrolled_list_begin(&ul);
+//     if (pass == 0) {
+//       for (int i = 0; !unrolled_iterator_equal(it, unrolled_list_end(&ul));
+//            i++) {
+//         it = unrolled_iterator_next(it);
+//         if (i % 2 == 0) {
+//           unrolled_list_insert(&ul, &it, &i);
+//           it = unrolled_iterator_next(it);
+//         }
+//       }
+//       lap("insert", ul.size);
+//     } else if (pass == 1) {
+//       for (int i = 0; !unrolled_iterator_equal(it, unrolled_list_end(&ul));
+//            i++) {
+//         it = i % 3 == 0 ? unrolled_list_erase(&ul, it)
+//                         : unrolled_iterator_next(it);
+//       }
+//       lap("erase", ul.size);
+//     }
+//   }
+//   destroy_unrolled_list(&ul);
+//
+//   printf("doubly_linked_list:\n");
+//   lap_begin = clock();
+//   doubly_linked_list dl;
+//   INIT_LINKED_LIST(doubly_linked_list, &dl);
+//   for (int i = 0; i < N; i++) {
+//     intrusive_node *node = MAKE_NODE(int_node, node);
+//     CONTAINER_OF(int_node, node, node)->dat = i;
+//     INSERT_IN_FRONT_OF(&dl, dl.tail, node);
+//   }
+//   lap("push back", dl.size);
+//   for (int pass = 0; pass < 3; pass++) {
+//     sum = 0;
+//     for (intrusive_node *it = dl.head->next; it != dl.tail; it = it->next) {
+//       sum += CONTAINER_OF(int_node, node, it)->dat;
+//     }
+//     lap("sum", sum);
+//     intrusive_node *it = dl.head->next;
+//     if (pass == 0) {
+//       for (int i = 0; it != dl.tail; i++, it = it->next) {
+//         if (i % 2 == 0) {
+//           intrusive_node *node = MAKE_NODE(int_node, node);
+//           CONTAINER_OF(int_node, node, node)->dat = i;
+//           INSERT_BEHIND(&dl, it, node);
+//           it = node;
+//         }
+//       }
+//       lap("insert", dl.size);
+//     } else if (pass == 1) {
+//       for (int i = 0; it != dl.tail; i++) {
+//         intrusive_node *next = it->next;
+//         if (i % 3 == 0) REMOVE_AND_RELEASE(int_node, node, &dl, it);
+//         it = next;
+//       }
+//       lap("erase", dl.size);
+//     }
+//   }
+//   DESTROY_LIST(int_node, node, doubly_linked_list, &dl);
+// }
+
+// Node pool.
+// Nodes of one type carved out of big slabs, with the freed ones kept on a
+// free list, so that a list or queue which keeps making and releasing nodes
+// (the bfs_node of binary_node_level_order) does not go through malloc /
+// free for every node. The free list is linked through the intrusive_node of
+// the free nodes, so a whole list is given back by splicing its chain, in
+// O(1). destroy_list_node_pool releases all the slabs at once.
+// The *_IN_POOL macros take the arguments of MAKE_NODE, RELEASE_NODE,
+// REMOVE_AND_RELEASE and DESTROY_LIST plus the pool.
+// Notice: the pool is not thread safe, use one pool per list or per thread.
+
+#define LIST_NODE_POOL_MIN_SLAB 64
+#define LIST_NODE_POOL_MAX_SLAB 65536
+
+typedef struct _list_node_slab {
+  struct _list_node_slab *next;
+  size_t capacity;
+} _list_node_slab;
+
+typedef struct list_node_pool {
+  size_t node_size;
+  size_t offset;
+  intrusive_node *free_list;
+  char *bump, *bump_end;
+  _list_node_slab *slabs;
+  size_t next_slab_capacity;
+  size_t in_use;
+} list_node_pool;
+
+// The header of a slab is padded so that the nodes inside keep the alignment
+// malloc would give them.
+#define _LIST_NODE_SLAB_HEADER                             \
+  ((sizeof(_list_node_slab) + sizeof(long double) - 1) /   \
+   sizeof(long double) * sizeof(long double))
+
+int _init_list_node_pool_(list_node_pool *pool, size_t node_size,
+                          size_t offset) {
+  if (pool == NULL) {
+    return -1;
+  }
+  // Keep every node aligned in the same way as malloc does.
+  node_size = (node_size + sizeof(long double) - 1) / sizeof(long double) *
+              sizeof(long double);
+  pool->node_size = node_size, pool->offset = offset;
+  pool->free_list = NULL;
+  pool->bump = NULL, pool->bump_end = NULL;
+  pool->slabs = NULL;
+  pool->next_slab_capacity = LIST_NODE_POOL_MIN_SLAB;
+  pool->in_use = 0;
+  return 0;
+}
+
+#define INIT_LIST_NODE_POOL(NODE_TYPE, MEMBER, POOL_PTR) \
+  _init_list_node_pool_((POOL_PTR), sizeof(NODE_TYPE),   \
+                        offsetof(NODE_TYPE, MEMBER))
+
+static int _list_node_pool_grow(list_node_pool *pool) {
+  size_t capacity = pool->next_slab_capacity;
+  _list_node_slab *slab = (_list_node_slab *)malloc(
+      _LIST_NODE_SLAB_HEADER + capacity * pool->node_size);
+  if (slab == NULL) {
+    perror("Grow list node pool failed!");
+    return -2;
+  }
+  slab->capacity = capacity;
+  slab->next = pool->slabs;
+  pool->slabs = slab;
+  pool->bump = (char *)slab + _LIST_NODE_SLAB_HEADER;
+  pool->bump_end = pool->bump + capacity * pool->node_size;
+  if (capacity < LIST_NODE_POOL_MAX_SLAB) {
+    pool->next_slab_capacity = capacity * 2;
+  }
+  return 0;
+}
+
+// Returns the intrusive_node of a new node, NULL if no slab can be had.
+intrusive_node *_list_pool_alloc(list_node_pool *pool, size_t size,
+                                 size_t offset) {
+  assert(pool->offset == offset);
+  assert(size <= pool->node_size);
+  intrusive_node *node;
+  if (pool->free_list) {
+    node = pool->free_list;
+    pool->free_list = node->next;
+  } else {
+    if (pool->bump == pool->bump_end && _list_node_pool_grow(pool)) {
+      return NULL;
+    }
+    node = (intrusive_node *)(pool->bump + offset);
+    pool->bump += pool->node_size;
+  }
+  pool->in_use++;
+  return node;
+}
+
+void _list_pool_release(list_node_pool *pool, intrusive_node *node) {
+  if (node == NULL) {
+    return;
+  }
+  node->next = pool->free_list;
+  pool->free_list = node;
+  pool->in_use--;
+}
+
+// Give the count nodes from first to last, linked by next, back at once.
+void _list_pool_release_chain(list_node_pool *pool, intrusive_node *first,
+                              intrusive_node *last, size_t count) {
+  if (count == 0) {
+    return;
+  }
+  last->next = pool->free_list;
+  pool->free_list = first;
+  pool->in_use -= count;
+}
+
+// Release every slab of the pool, every node made from it becomes invalid,
+// no matter which list it is in.
+void destroy_list_node_pool(list_node_pool *pool) {
+  _list_node_slab *slab = pool->slabs;
+  while (slab) {
+    _list_node_slab *next = slab->next;
+    free(slab);
+    slab = next;
+  }
+  pool->slabs = NULL;
+  pool->free_list = NULL;
+  pool->bump = NULL, pool->bump_end = NULL;
+  pool->next_slab_capacity = LIST_NODE_POOL_MIN_SLAB;
+  pool->in_use = 0;
+}
+
+size_t list_node_pool_in_use(list_node_pool *pool) { return pool->in_use; }
+
+intrusive_node *_last_node_doubly_linked_list_(doubly_linked_list *list_ptr) {
+  return list_ptr->tail->prev;
+}
+
+intrusive_node *_last_node_circular_linked_list_(
+    circular_linked_list *list_ptr) {
+  return list_ptr->head->prev;
+}
+
+#define MAKE_NODE_IN_POOL(NODE_TYPE, MEMBER, POOL_PTR) \
+  _list_pool_alloc((POOL_PTR), sizeof(NODE_TYPE), offsetof(NODE_TYPE, MEMBER))
+
+#define RELEASE_NODE_IN_POOL(NODE_TYPE, MEMBER, NODE_PTR, POOL_PTR) \
+  (assert((POOL_PTR)->offset == offsetof(NODE_TYPE, MEMBER)),       \
+   _list_pool_release((POOL_PTR), (NODE_PTR)))
+
+#define REMOVE_AND_RELEASE_IN_POOL(NODE_TYPE, MEMBER, LIST_PTR, NODE_PTR, \
+                                   POOL_PTR)                              \
+  do {                                                                    \
+    intrusive_node *_NODE_TO_DEL = NODE_PTR;                              \
+    assert(_NODE_TO_DEL != (LIST_PTR)->head);                             \
+    REMOVE_NODE_FROM_LIST(LIST_PTR, _NODE_TO_DEL);                        \
+    RELEASE_NODE_IN_POOL(NODE_TYPE, MEMBER, _NODE_TO_DEL, POOL_PTR);      \
+  } while (0)
+
+// The nodes of the list are handed back as one chain, from the first to the
+// last, in O(1).
+#define DESTROY_LIST_IN_POOL(NODE_TYPE, MEMBER, LIST_TYPE, LIST_PTR, POOL_PTR) \
+  do {                                                                     \
+    assert((POOL_PTR)->offset == offsetof(NODE_TYPE, MEMBER));             \
+    if ((LIST_PTR)->size) {                                                \
+      _list_pool_release_chain((POOL_PTR), (LIST_PTR)->head->next,         \
+                               _last_node_##LIST_TYPE##_(LIST_PTR),        \
+                               (LIST_PTR)->size);                          \
+      (LIST_PTR)->size = 0;                                                \
+    }                                                                      \
+    _free_empty_##LIST_TYPE##_(LIST_PTR);                                  \
+  } while (0)
+
+// Test code, 10M pushes and pops on a linked_queue with nodes from malloc and
+// from a list_node_pool: a queue kept 1000 deep (a level order walk) and one
+// filled to 10M before it is drained.
+// #include <time.h>
+//
+// typedef struct int_node {
+//   int dat;
+//   intrusive_node node;
+// } int_node;
+//
+// double run(list_node_pool *pool, int depth, int n) {
+//   linked_queue queue;
+//   init_linked_queue(&queue);
+//   long long sum = 0;
+//   clock_t begin = clock();
+//   for (int i = 0; i < n; i++) {
+//     intrusive_node *node = pool ? MAKE_NODE_IN_POOL(int_node, node, pool)
+//                                 : MAKE_NODE(int_node, node);
+//     CONTAINER_OF(int_node, node, node)->dat = i;
+//     linked_queue_push(&queue, node);
+//     if ((int)queue.size > depth) {
+//       node = linked_queue_pop(&queue);
+//       sum += CONTAINER_OF(int_node, node, node)->dat;
+//       if (pool) {
+//         RELEASE_NODE_IN_POOL(int_node, node, node, pool);
+//       } else {
+//         RELEASE_NODE(int_node, node, node);
+//       }
+//     }
+//   }
+//   if (pool) {
+//     DESTROY_LIST_IN_POOL(int_node, node, circular_linked_list, &queue, pool);
+//   } else {
+//     DESTROY_LIST(int_node, node, circular_linked_list, &queue);
+//   }
+//   double time = (double)(clock() - begin) / CLOCKS_PER_SEC;
+//   assert(sum >= 0);
+//   return time;
+// }
+//
+// int main(void) {
+//   const int N = 10000000;
+//   for (int depth = 1000; depth <= N; depth = depth == N ? N + 1 : N) {
+//     list_node_pool pool;
+//     INIT_LIST_NODE_POOL(int_node, node, &pool);
+//     printf("depth %d: malloc %.3fs", depth, run(NULL, depth, N));
+//     printf(", pool %.3fs", run(&pool, depth, N));
+//     printf(", pool reused %.3fs\n", run(&pool, depth, N));
+//     destroy_list_node_pool(&pool);
+//   }
+// }
+
+#ifdef ENABLE_CONCURRENT
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Bounded MPMC queue (Vyukov).
+// A ring of slots, each with a sequence number telling whose turn it is: the
+// slot of position pos is free for the producer which claims pos when its
+// sequence is pos, and holds a node for the consumer which claims pos when
+// its sequence is pos + 1. Producers and consumers claim positions with a CAS
+// on their own counter, a full or an empty queue is reported instead of
+// waited on. The queue only passes the nodes on, a popped node may go on any
+// list.
+
+#define MPMC_QUEUE_CACHE_LINE 64
+
+typedef struct _mpmc_slot {
+  _Atomic size_t seq;
+  intrusive_node *node;
+} _mpmc_slot;
+
+typedef struct mpmc_queue {
+  _mpmc_slot *slots;
+  size_t mask;
+  // The two counters are on their own cache lines, producers and consumers
+  // do not bounce each other's.
+  char pad0[MPMC_QUEUE_CACHE_LINE - sizeof(_mpmc_slot *) - sizeof(size_t)];
+  _Atomic size_t enqueue_pos;
+  char pad1[MPMC_QUEUE_CACHE_LINE - sizeof(size_t)];
+  _Atomic size_t dequeue_pos;
+  char pad2[MPMC_QUEUE_CACHE_LINE - sizeof(size_t)];
+} mpmc_queue;
+
+// capacity is rounded up to a power of 2. Returns 0, or -2 if the ring cannot
+// be allocated.
+int init_mpmc_queue(mpmc_queue *queue, size_t capacity) {
+  size_t cap = 2;
+  while (cap < capacity) {
+    cap *= 2;
+  }
+  queue->slots = (_mpmc_slot *)malloc(cap * sizeof(_mpmc_slot));
+  if (queue->slots == NULL) {
+    perror("Init mpmc queue failed!");
+    return -2;
+  }
+  for (size_t i = 0; i < cap; i++) {
+    atomic_init(&queue->slots[i].seq, i);
+    queue->slots[i].node = NULL;
+  }
+  queue->mask = cap - 1;
+  atomic_init(&queue->enqueue_pos, 0);
+  atomic_init(&queue->dequeue_pos, 0);
+  return 0;
+}
+
+// No thread may be using the queue, the nodes still in it are left alone.
+void destroy_mpmc_queue(mpmc_queue *queue) {
+  free(queue->slots);
+  queue->slots = NULL;
+}
+
+// Returns false if the queue is full.
+bool mpmc_queue_push(mpmc_queue *queue, intrusive_node *node) {
+  size_t pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+  while (true) {
+    _mpmc_slot *slot = &queue->slots[pos & queue->mask];
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0) {
+      // A failed CAS loads the current position into pos.
+      if (atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos,
+                                                pos + 1, memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        slot->node = node;
+        atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      // The consumer of the last round has not freed the slot.
+      return false;
+    } else {
+      pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+    }
+  }
+}
+
+// Returns NULL if the queue is empty.
+intrusive_node *mpmc_queue_pop(mpmc_queue *queue) {
+  size_t pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+  while (true) {
+    _mpmc_slot *slot = &queue->slots[pos & queue->mask];
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos,
+                                                pos + 1, memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        intrusive_node *node = slot->node;
+        // Free for the producer of the next round.
+        atomic_store_explicit(&slot->seq, pos + queue->mask + 1,
+                              memory_order_release);
+        return node;
+      }
+    } else if (diff < 0) {
+      return NULL;
+    } else {
+      pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+    }
+  }
+}
+
+// Unbounded intrusive MPSC queue (Vyukov).
+// The nodes are linked through next from the oldest (tail) to the newest
+// (head). A producer swaps itself in as the head with one atomic exchange and
+// then links the old head to itself, so pushes never wait or retry. The
+// single consumer follows next from the tail, a stub node keeps the list
+// from ever being empty.
+// Between the exchange and the link of a push the newer nodes are not
+// reachable yet, pop then returns NULL although the queue is not empty, and
+// the consumer has to try again.
+
+typedef struct mpsc_queue {
+  // Producers.
+  intrusive_node *head;
+  char pad[MPMC_QUEUE_CACHE_LINE - sizeof(intrusive_node *)];
+  // Consumer.
+  intrusive_node *tail;
+  intrusive_node stub;
+} mpsc_queue;
+
+void init_mpsc_queue(mpsc_queue *queue) {
+  queue->stub.next = NULL;
+  queue->stub.prev = NULL;
+  queue->head = &queue->stub;
+  queue->tail = &queue->stub;
+}
+
+void mpsc_queue_push(mpsc_queue *queue, intrusive_node *node) {
+  __atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+  intrusive_node *prev = __atomic_exchange_n(&queue->head, node,
+                                             __ATOMIC_ACQ_REL);
+  __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+// Only one thread may pop. Returns NULL if the queue is empty, or a push is
+// half done.
+intrusive_node *mpsc_queue_pop(mpsc_queue *queue) {
+  intrusive_node *tail = queue->tail;
+  intrusive_node *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+  if (tail == &queue->stub) {
+    if (next == NULL) {
+      return NULL;
+    }
+    queue->tail = next;
+    tail = next;
+    next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+  }
+  if (next) {
+    queue->tail = next;
+    return tail;
+  }
+  if (tail != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE)) {
+    return NULL;
+  }
+  // tail is the last node, put the stub behind it so that it can be taken.
+  mpsc_queue_push(queue, &queue->stub);
+  next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+  if (next) {
+    queue->tail = next;
+    return tail;
+  }
+  return NULL;
+}
+
+#endif
+
+// Test code, 4M nodes handed from P producers to C consumers at 1P1C, 4P4C
+// and 16P16C through the MPMC ring (1024 slots), through a linked_queue
+// under a mutex, and at 1P1C, 4P1C and 16P1C through the MPSC queue:
+// throughput and the push to pop latency (mean, p99, max). Full and empty
+// queues are waited on with sched_yield. The unbounded queues let producers
+// run ahead of the consumers, their latency is mostly the backlog, while the
+// ring holds at most 1024 nodes.
+// #include <pthread.h>
+// #include <sched.h>
+// #include <time.h>
+//
+// #define TOTAL 4000000
+//
+// typedef struct stamped_node {
+//   long long stamp;
+//   intrusive_node node;
+// } stamped_node;
+//
+// enum { MPMC, LOCKED, MPSC } kind;
+// int producers, consumers;
+// stamped_node *nodes;
+// mpmc_queue ring;
+// mpsc_queue mpsc;
+// linked_queue locked;
+// pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+// _Atomic int left;
+// // Latency histogram by powers of 2 of ns, and the max.
+// _Atomic long long histogram[64], max_latency, total_latency;
+//
+// long long now(void) {
+//   struct timespec ts;
+//   clock_gettime(CLOCK_MONOTONIC, &ts);
+//   return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+// }
+//
+// void *produce(void *arg) {
+//   int id = (int)(intptr_t)arg;
+//   for (int i = id; i < TOTAL; i += producers) {
+//     nodes[i].stamp = now();
+//     if (kind == MPMC) {
+//       while (!mpmc_queue_push(&ring, &nodes[i].node)) sched_yield();
+//     } else if (kind == MPSC) {
+//       mpsc_queue_push(&mpsc, &nodes[i].node);
+//     } else {
+//       pthread_mutex_lock(&lock);
+//       linked_queue_push(&locked, &nodes[i].node);
+//       pthread_mutex_unlock(&lock);
+//     }
+//   }
+//   return NULL;
+// }
+//
+// void *consume(void *arg) {
+//   (void)arg;
+//   long long local_max = 0, local_total = 0;
+//   while (atomic_load_explicit(&left, memory_order_relaxed) > 0) {
+//     intrusive_node *node = NULL;
+//     if (kind == MPMC) {
+//       node = mpmc_queue_pop(&ring);
+//     } else if (kind == MPSC) {
+//       node = mpsc_queue_pop(&mpsc);
+//     } else {
+//       pthread_mutex_lock(&lock);
+//       if (!linked_queue_empty(&locked)) node = linked_queue_pop(&locked);
+//       pthread_mutex_unlock(&lock);
+//     }
+//     if (node == NULL) {
+//       sched_yield();
+//       continue;
+//     }
+//     long long latency =
+//         now() - CONTAINER_OF(stamped_node, node, node)->stamp;
+//     int bucket = 0;
+//     while ((1LL << bucket) < latency) bucket++;
+//     atomic_fetch_add_explicit(&histogram[bucket], 1, memory_order_relaxed);
+//     local_total += latency;
+//     if (latency > local_max) local_max = latency;
+//     atomic_fetch_sub_explicit(&left, 1, memory_order_relaxed);
+//   }
+//   atomic_fetch_add(&total_latency, local_total);
+//   long long seen = atomic_load(&max_latency);
+//   while (local_max > seen &&
+//          !atomic_compare_exchange_weak(&max_latency, &seen, local_max)) {
+//   }
+//   return NULL;
+// }
+//
+// void run(const char *name, int p, int c) {
+//   producers = p, consumers = c;
+//   atomic_store(&left, TOTAL);
+//   atomic_store(&max_latency, 0);
+//   atomic_store(&total_latency, 0);
+//   for (int i = 0; i < 64; i++) atomic_store(&histogram[i], 0);
+//   pthread_t threads[32];
+//   long long begin = now();
+//   for (int i = 0; i < c; i++) {
+//     pthread_create(&threads[i], NULL, consume, NULL);
+//   }
+//   for (int i = 0; i < p; i++) {
+//     pthread_create(&threads[c + i], NULL, produce, (void *)(intptr_t)i);
+//   }
+//   for (int i = 0; i < p + c; i++) pthread_join(threads[i], NULL);
+//   double seconds = (now() - begin) / 1e9;
+//   long long count = 0, p99 = 0;
+//   for (int i = 0; i < 64 && !p99; i++) {
+//     count += histogram[i];
+//     if (count >= TOTAL / 100 * 99) p99 = 1LL << i;
+//   }
+//   printf("%s %dP%dC: %.2f M/s, latency mean %lld ns, p99 < %lld ns, "
+//          "max %lld ns\n",
+//          name, p, c, TOTAL / seconds / 1e6, total_latency / TOTAL, p99,
+//          (long long)max_latency);
+// }
+//
+// int main(void) {
+//   nodes = malloc(TOTAL * sizeof(stamped_node));
+//   init_mpmc_queue(&ring, 1024);
+//   init_linked_queue(&locked);
+//   init_mpsc_queue(&mpsc);
+//   int pairs[] = {1, 4, 16};
+//   for (int i = 0; i < 3; i++) {
+//     kind = MPMC;
+//     run("mpmc", pairs[i], pairs[i]);
+//     kind = LOCKED;
+//     run("locked linked_queue", pairs[i], pairs[i]);
+//     kind = MPSC;
+//     run("mpsc", pairs[i], 1);
+//   }
+//   destroy_mpmc_queue(&ring);
+//   free(nodes);
+// }
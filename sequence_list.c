@@ -174,6 +174,11 @@ void destroy_sequence_list(sequence_list *lst) {
 bool sequence_list_empty(sequence_list *lst) { return lst->size == 0; }
 
 // Sqeuence queue
+// A ring buffer over lst, whose size is the capacity of the ring, always a
+// power of 2. begin_pos and end_pos only ever count up, the slot of a
+// position is its low bits (pos & (size - 1)), so no % is taken. A push on a
+// full queue doubles the ring, copying the elements to the front of the new
+// one in order.
 
 typedef struct sequence_queue {
   size_t begin_pos;
@@ -181,13 +186,30 @@ typedef struct sequence_queue {
   sequence_list lst;
 } sequence_queue;
 
-#define INIT_SEQUENCE_QUEUE(TYPE, Q_PTR, CAPACITY)           \
-  do {                                                       \
-    INIT_SEQUENCE_LIST(TYPE, (&((Q_PTR)->lst)));             \
-    SEQUENCE_LIST_RESIZE(TYPE, (&((Q_PTR)->lst)), CAPACITY); \
-    ((Q_PTR)->begin_pos) = 0;                                \
-    ((Q_PTR)->end_pos) = 0;                                  \
-  } while (0)
+int _init_sequence_queue_(sequence_queue *queue, size_t elem_size,
+                          size_t capacity) {
+  size_t cap = 1;
+  while (cap < capacity) {
+    cap *= 2;
+  }
+  queue->begin_pos = 0;
+  queue->end_pos = 0;
+  queue->lst.data = malloc(cap * elem_size);
+  if (queue->lst.data == NULL) {
+    perror("Fail to init the queue.");
+    queue->lst.size = queue->lst.capacity = 0;
+    return -2;
+  }
+  queue->lst.size = queue->lst.capacity = cap;
+  return 0;
+}
+
+#define INIT_SEQUENCE_QUEUE(TYPE, Q_PTR, CAPACITY) \
+  _init_sequence_queue_((Q_PTR), sizeof(TYPE), (CAPACITY))
+
+size_t sequence_queue_size(sequence_queue *queue) {
+  return queue->end_pos - queue->begin_pos;
+}
 
 bool sequence_queue_empty(sequence_queue *queue) {
   return queue->begin_pos == queue->end_pos;
@@ -197,30 +219,114 @@ bool sequence_queue_full(sequence_queue *queue) {
   return (queue->end_pos - queue->begin_pos) >= queue->lst.size;
 }
 
-#define SEQUENCE_QUEUE_PUSH(TYPE, Q_PTR, VAL)                                  \
-  do {                                                                         \
-    if (!sequence_queue_full((Q_PTR))) {                                       \
-      SEQUENCE_LIST_REFERENCE(TYPE, (&((Q_PTR)->lst)), (((Q_PTR)->end_pos))) = \
-          (VAL);                                                               \
-      ((Q_PTR)->end_pos)++;                                                    \
-    } else {                                                                   \
-      perror("The queue is full, giving up...");                               \
-    }                                                                          \
+// Copy count elements of the ring from position pos to dst, or from src to
+// the ring, in at most two pieces.
+void _sequence_queue_copy_out(sequence_queue *queue, size_t elem_size,
+                              size_t pos, void *dst, size_t count) {
+  size_t slot = pos & (queue->lst.size - 1);
+  size_t first = queue->lst.size - slot;
+  first = first < count ? first : count;
+  memcpy(dst, (char *)queue->lst.data + slot * elem_size, first * elem_size);
+  memcpy((char *)dst + first * elem_size, queue->lst.data,
+         (count - first) * elem_size);
+}
+
+void _sequence_queue_copy_in(sequence_queue *queue, size_t elem_size,
+                             size_t pos, const void *src, size_t count) {
+  size_t slot = pos & (queue->lst.size - 1);
+  size_t first = queue->lst.size - slot;
+  first = first < count ? first : count;
+  memcpy((char *)queue->lst.data + slot * elem_size, src, first * elem_size);
+  memcpy(queue->lst.data, (const char *)src + first * elem_size,
+         (count - first) * elem_size);
+}
+
+// Grow the ring to hold at least capacity elements. Returns 0, or -2 if the
+// memory cannot be had, the queue is then left as it was.
+int _sequence_queue_grow(sequence_queue *queue, size_t elem_size,
+                         size_t capacity) {
+  size_t cap = MAX_OF(queue->lst.size, 1);
+  while (cap < capacity) {
+    cap *= 2;
+  }
+  if (cap == queue->lst.size) {
+    return 0;
+  }
+  void *new_data = malloc(cap * elem_size);
+  if (new_data == NULL) {
+    perror("Fail to alloc extra memory, rollback...");
+    return -2;
+  }
+  size_t count = sequence_queue_size(queue);
+  if (count) {
+    _sequence_queue_copy_out(queue, elem_size, queue->begin_pos, new_data,
+                             count);
+  }
+  free(queue->lst.data);
+  queue->lst.data = new_data;
+  queue->lst.size = queue->lst.capacity = cap;
+  queue->begin_pos = 0;
+  queue->end_pos = count;
+  return 0;
+}
+
+#define _SEQUENCE_QUEUE_SLOT(TYPE, Q_PTR, POS) \
+  (((TYPE *)((Q_PTR)->lst.data))[(POS) & (((Q_PTR)->lst.size) - 1)])
+
+#define SEQUENCE_QUEUE_PUSH(TYPE, Q_PTR, VAL)                              \
+  do {                                                                     \
+    if (!sequence_queue_full((Q_PTR)) ||                                   \
+        !_sequence_queue_grow((Q_PTR), sizeof(TYPE),                       \
+                              ((Q_PTR)->lst.size) * 2)) {                  \
+      _SEQUENCE_QUEUE_SLOT(TYPE, (Q_PTR), ((Q_PTR)->end_pos)) = (VAL);     \
+      ((Q_PTR)->end_pos)++;                                                \
+    }                                                                      \
   } while (0)
 
 void sequence_queue_pop(sequence_queue *queue) {
   if (!sequence_queue_empty(queue)) {
     (queue->begin_pos)++;
-    if (queue->begin_pos >= queue->lst.size) {
-      queue->begin_pos -= queue->lst.size;
-      queue->end_pos -= queue->lst.size;
-    }
   } else {
     perror("The queue is already empty, giving up...");
   }
 }
 #define SEQUENCE_QUEUE_FRONT(TYPE, Q_PTR) \
-  SEQUENCE_LIST_REFERENCE(TYPE, (&((Q_PTR)->lst)), ((Q_PTR)->begin_pos))
+  _SEQUENCE_QUEUE_SLOT(TYPE, (Q_PTR), ((Q_PTR)->begin_pos))
+
+// Push the n elements of the array src, growing the ring once if needed.
+// Returns 0, or -2 if the ring cannot grow, nothing is pushed then.
+int _sequence_queue_push_n(sequence_queue *queue, size_t elem_size,
+                           const void *src, size_t n) {
+  size_t count = sequence_queue_size(queue);
+  if (count + n > queue->lst.size &&
+      _sequence_queue_grow(queue, elem_size, count + n)) {
+    return -2;
+  }
+  _sequence_queue_copy_in(queue, elem_size, queue->end_pos, src, n);
+  queue->end_pos += n;
+  return 0;
+}
+
+#define SEQUENCE_QUEUE_PUSH_N(TYPE, Q_PTR, SRC, N) \
+  _sequence_queue_push_n((Q_PTR), sizeof(TYPE), (SRC), (N))
+
+// Pop up to n elements from the front into the array dst (dropped if dst is
+// NULL). Returns the number of elements popped.
+size_t _sequence_queue_pop_n(sequence_queue *queue, size_t elem_size,
+                             void *dst, size_t n) {
+  size_t count = sequence_queue_size(queue);
+  if (n > count) {
+    n = count;
+  }
+  if (dst && n) {
+    _sequence_queue_copy_out(queue, elem_size, queue->begin_pos, dst, n);
+  }
+  queue->begin_pos += n;
+  return n;
+}
+
+#define SEQUENCE_QUEUE_POP_N(TYPE, Q_PTR, DST, N) \
+  _sequence_queue_pop_n((Q_PTR), sizeof(TYPE), (DST), (N))
 
 void destroy_sequence_queue(sequence_queue *queue) {
   destroy_sequence_list(&queue->lst);
@@ -228,6 +334,79 @@ void destroy_sequence_queue(sequence_queue *queue) {
   queue->end_pos = 0;
 }
 
+// Test code, a BFS over the implicit binary tree of 10M nodes (children
+// 2i + 1 and 2i + 2) with the queue as it was (fixed capacity, a % on every
+// access, given room for all 10M), the ring starting from 1 slot and from
+// room for all 10M, and the ring fed in bulk, 64 nodes popped and their
+// children pushed at a time.
+// #include <time.h>
+//
+// int main(void) {
+//   const size_t N = 10000000;
+//   long long sum = 0;
+//
+//   // size as a variable, the way the old queue read it from lst.size.
+//   volatile size_t capacity = N;
+//   clock_t begin = clock();
+//   size_t size = capacity, head = 0, tail = 0;
+//   size_t *data = malloc(size * sizeof(size_t));
+//   data[tail++ % size] = 0;
+//   while (head != tail) {
+//     size_t node = data[head % size];
+//     head++;
+//     if (head >= size) head -= size, tail -= size;
+//     sum += node;
+//     if (2 * node + 1 < N) data[tail++ % size] = 2 * node + 1;
+//     if (2 * node + 2 < N) data[tail++ % size] = 2 * node + 2;
+//   }
+//   free(data);
+//   printf("modulo: %.3fs (%lld)\n",
+//          (double)(clock() - begin) / CLOCKS_PER_SEC, sum);
+//
+//   sequence_queue queue;
+//   size_t initials[] = {1, N};
+//   for (int i = 0; i < 2; i++) {
+//     size_t initial = initials[i];
+//     sum = 0;
+//     begin = clock();
+//     INIT_SEQUENCE_QUEUE(size_t, &queue, initial);
+//     SEQUENCE_QUEUE_PUSH(size_t, &queue, 0);
+//     while (!sequence_queue_empty(&queue)) {
+//       size_t node = SEQUENCE_QUEUE_FRONT(size_t, &queue);
+//       sequence_queue_pop(&queue);
+//       sum += node;
+//       if (2 * node + 1 < N) {
+//         SEQUENCE_QUEUE_PUSH(size_t, &queue, 2 * node + 1);
+//       }
+//       if (2 * node + 2 < N) {
+//         SEQUENCE_QUEUE_PUSH(size_t, &queue, 2 * node + 2);
+//       }
+//     }
+//     printf("ring from %zu: %.3fs (%lld), %zu slots\n", initial,
+//            (double)(clock() - begin) / CLOCKS_PER_SEC, sum, queue.lst.size);
+//     destroy_sequence_queue(&queue);
+//   }
+//
+//   sum = 0;
+//   begin = clock();
+//   size_t batch[64], children[128];
+//   INIT_SEQUENCE_QUEUE(size_t, &queue, 1);
+//   SEQUENCE_QUEUE_PUSH(size_t, &queue, 0);
+//   size_t n;
+//   while ((n = SEQUENCE_QUEUE_POP_N(size_t, &queue, batch, 64))) {
+//     size_t m = 0;
+//     for (size_t i = 0; i < n; i++) {
+//       sum += batch[i];
+//       if (2 * batch[i] + 1 < N) children[m++] = 2 * batch[i] + 1;
+//       if (2 * batch[i] + 2 < N) children[m++] = 2 * batch[i] + 2;
+//     }
+//     SEQUENCE_QUEUE_PUSH_N(size_t, &queue, children, m);
+//   }
+//   printf("bulk: %.3fs (%lld), %zu slots\n",
+//          (double)(clock() - begin) / CLOCKS_PER_SEC, sum, queue.lst.size);
+//   destroy_sequence_queue(&queue);
+// }
+
 // Sequence stack
 
 typedef sequence_list sequence_stack;
@@ -0,0 +1,917 @@
+#ifndef HAOMI_SORTED_SEARCH_H
+#define HAOMI_SORTED_SEARCH_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace haomi {
+
+// Searches over read only sorted arrays.
+// branchlessLowerBound works on the sorted array itself. EytzingerArray and
+// STree copy it once into a layout which suits the cache better, and answer
+// lowerBound with the value found rather than its index. Every search has a
+// batch form, which walks a group of keys level by level so that the loads
+// of different keys overlap instead of waiting for each other.
+
+// Keys of a batch walked together.
+constexpr size_t SEARCH_BATCH_GROUP = 16;
+
+template <typename T>
+static inline void _prefetch(const T *ptr) {
+#ifdef __GNUC__
+  __builtin_prefetch(ptr);
+#else
+  (void)ptr;
+#endif
+}
+
+// Aligned array of T, the storage of the layouts below.
+template <typename T>
+class _AlignedArray {
+ public:
+  explicit _AlignedArray(size_t count = 0) : count(count) {
+    if (count) {
+      data = static_cast<T *>(
+          ::operator new(sizeof(T) * count, std::align_val_t(64)));
+    }
+  }
+  _AlignedArray(const _AlignedArray &) = delete;
+  _AlignedArray &operator=(const _AlignedArray &) = delete;
+  _AlignedArray(_AlignedArray &&other) noexcept
+      : data(std::exchange(other.data, nullptr)),
+        count(std::exchange(other.count, 0)) {}
+  _AlignedArray &operator=(_AlignedArray &&other) noexcept {
+    std::swap(data, other.data);
+    std::swap(count, other.count);
+    return *this;
+  }
+  ~_AlignedArray() {
+    if (data) {
+      ::operator delete(data, std::align_val_t(64));
+    }
+  }
+
+  T &operator[](size_t i) { return data[i]; }
+  const T &operator[](size_t i) const { return data[i]; }
+  size_t size() const { return count; }
+
+ private:
+  T *data = nullptr;
+  size_t count;
+};
+
+// Index of the first element not less than key, n if there is none. The
+// compare picks the half by a conditional move, so the loop never
+// mispredicts; the two possible next midpoints are prefetched.
+template <typename T>
+size_t branchlessLowerBound(const T *arr, size_t n, const T &key) {
+  if (n == 0) {
+    return 0;
+  }
+  const T *base = arr;
+  size_t len = n;
+  while (len > 1) {
+    size_t half = len / 2;
+    _prefetch(base + half / 2);
+    _prefetch(base + half + half / 2);
+    base = base[half - 1] < key ? base + half : base;
+    len -= half;
+  }
+  return (base - arr) + (*base < key);
+}
+
+template <typename T>
+void branchlessLowerBoundBatch(const T *arr, size_t n, const T *keys,
+                               size_t m, size_t *res) {
+  for (size_t begin = 0; begin < m; begin += SEARCH_BATCH_GROUP) {
+    size_t group = m - begin < SEARCH_BATCH_GROUP ? m - begin
+                                                  : SEARCH_BATCH_GROUP;
+    const T *base[SEARCH_BATCH_GROUP];
+    for (size_t j = 0; j < group; ++j) {
+      base[j] = arr;
+    }
+    // Every key halves the same lengths, so the group stays in step.
+    size_t len = n;
+    while (len > 1) {
+      size_t half = len / 2;
+      for (size_t j = 0; j < group; ++j) {
+        _prefetch(base[j] + half + half / 2);
+      }
+      for (size_t j = 0; j < group; ++j) {
+        base[j] = base[j][half - 1] < keys[begin + j] ? base[j] + half
+                                                      : base[j];
+      }
+      len -= half;
+    }
+    for (size_t j = 0; j < group; ++j) {
+      res[begin + j] =
+          n ? (base[j] - arr) + (*base[j] < keys[begin + j]) : 0;
+    }
+  }
+}
+
+// Eytzinger layout: the sorted array stored as an implicit binary search tree
+// in BFS order, node k at index k with children 2k and 2k + 1 (index 0 is
+// unused). The top levels share a few cache lines, and the descendants of a
+// node log2(64 / sizeof(T)) levels down (16 of them, four levels down, for 4
+// byte keys) lie in one line, which is prefetched while the next levels are
+// walked.
+template <typename T>
+class EytzingerArray {
+ public:
+  // arr must be sorted.
+  EytzingerArray(const T *arr, size_t n) : tree(n + 1), n(n) {
+    size_t pos = 0;
+    fill(arr, pos, 1);
+    // The levels every search walks in full.
+    fullLevels = 0;
+    while ((size_t(2) << fullLevels) - 1 <= n) {
+      ++fullLevels;
+    }
+  }
+
+  size_t size() const { return n; }
+
+  // Find the first element not less than key. Returns false if there is
+  // none, the element is copied into out otherwise.
+  bool lowerBound(const T &key, T &out) const {
+    size_t k = 1;
+    while (k <= n) {
+      prefetchDescendants(k);
+      k = 2 * k + (tree[k] < key);
+    }
+    return finish(k, out);
+  }
+
+  bool contains(const T &key) const {
+    T found{};
+    return lowerBound(key, found) && !(key < found);
+  }
+
+  // found[i] tells whether res[i] holds the lower bound of keys[i].
+  void lowerBoundBatch(const T *keys, size_t m, T *res, bool *found) const {
+    for (size_t begin = 0; begin < m; begin += SEARCH_BATCH_GROUP) {
+      size_t group = m - begin < SEARCH_BATCH_GROUP ? m - begin
+                                                    : SEARCH_BATCH_GROUP;
+      size_t k[SEARCH_BATCH_GROUP];
+      for (size_t j = 0; j < group; ++j) {
+        k[j] = 1;
+      }
+      for (size_t level = 0; level < fullLevels; ++level) {
+        for (size_t j = 0; j < group; ++j) {
+          prefetchDescendants(k[j]);
+          k[j] = 2 * k[j] + (tree[k[j]] < keys[begin + j]);
+        }
+      }
+      // The last level is not full, a search may already have left the
+      // tree.
+      for (size_t j = 0; j < group; ++j) {
+        if (k[j] <= n) {
+          k[j] = 2 * k[j] + (tree[k[j]] < keys[begin + j]);
+        }
+        found[begin + j] = finish(k[j], res[begin + j]);
+      }
+    }
+  }
+
+ private:
+  _AlignedArray<T> tree;
+  size_t n;
+  size_t fullLevels;
+
+  // Keys in a cache line, which is also how many descendants of a node the
+  // line holds.
+  static constexpr size_t LINE_KEYS = sizeof(T) < 64 ? 64 / sizeof(T) : 1;
+
+  // The index is clamped, so that no address past the array is formed near
+  // the leaves; the last line is fetched again there, which is harmless.
+  void prefetchDescendants(size_t k) const {
+    _prefetch(&tree[std::min(LINE_KEYS * k, n)]);
+  }
+
+  // In order walk of the implicit tree, filling it from the sorted array.
+  void fill(const T *arr, size_t &pos, size_t k) {
+    // The depth is log2(n), recursion is fine.
+    if (k <= n) {
+      fill(arr, pos, 2 * k);
+      tree[k] = arr[pos++];
+      fill(arr, pos, 2 * k + 1);
+    }
+  }
+
+  // The path ends with the right turns taken after the node looked for, drop
+  // them and the left turn at the node.
+  bool finish(size_t k, T &out) const {
+#ifdef __GNUC__
+    k >>= __builtin_ffsll(~static_cast<long long>(k));
+#else
+    while (k & 1) {
+      k >>= 1;
+    }
+    k >>= 1;
+#endif
+    if (k == 0) {
+      return false;
+    }
+    out = tree[k];
+    return true;
+  }
+};
+
+// S-tree: a static B-tree of blocks of B keys filling one cache line (16 for
+// int32_t), block k having the B + 1 children k(B + 1) + 1 .. k(B + 1) + B + 1.
+// A block is searched by counting its keys less than the key, with AVX2 for
+// int32_t and a plain loop the compiler may vectorize otherwise. The last
+// block is padded with the greatest value of T.
+template <typename T>
+class STree {
+ public:
+  static constexpr size_t B = 64 / sizeof(T) ? 64 / sizeof(T) : 1;
+
+  // arr must be sorted.
+  STree(const T *arr, size_t n)
+      : blockCount((n + B - 1) / B), blocks(blockCount * B), n(n) {
+    size_t pos = 0;
+    fill(arr, pos, 0);
+    if (n) {
+      maxKey = arr[n - 1];
+    }
+  }
+
+  size_t size() const { return n; }
+
+  bool lowerBound(const T &key, T &out) const {
+    if (n == 0 || maxKey < key) {
+      return false;
+    }
+    size_t k = 0;
+    while (k < blockCount) {
+      size_t i = rank(&blocks[k * B], key);
+      if (i < B) {
+        out = blocks[k * B + i];
+      }
+      k = k * (B + 1) + i + 1;
+    }
+    return true;
+  }
+
+  bool contains(const T &key) const {
+    T found{};
+    return lowerBound(key, found) && !(key < found);
+  }
+
+  void lowerBoundBatch(const T *keys, size_t m, T *res, bool *found) const {
+    for (size_t begin = 0; begin < m; begin += SEARCH_BATCH_GROUP) {
+      size_t group = m - begin < SEARCH_BATCH_GROUP ? m - begin
+                                                    : SEARCH_BATCH_GROUP;
+      size_t k[SEARCH_BATCH_GROUP];
+      bool active = false;
+      for (size_t j = 0; j < group; ++j) {
+        found[begin + j] = n != 0 && !(maxKey < keys[begin + j]);
+        k[j] = found[begin + j] ? 0 : blockCount;
+        active |= found[begin + j];
+      }
+      while (active) {
+        active = false;
+        for (size_t j = 0; j < group; ++j) {
+          if (k[j] < blockCount) {
+            _prefetch(&blocks[k[j] * B]);
+          }
+        }
+        for (size_t j = 0; j < group; ++j) {
+          if (k[j] >= blockCount) {
+            continue;
+          }
+          size_t i = rank(&blocks[k[j] * B], keys[begin + j]);
+          if (i < B) {
+            res[begin + j] = blocks[k[j] * B + i];
+          }
+          k[j] = k[j] * (B + 1) + i + 1;
+          active |= k[j] < blockCount;
+        }
+      }
+    }
+  }
+
+ private:
+  size_t blockCount;
+  _AlignedArray<T> blocks;
+  size_t n;
+  T maxKey{};
+
+  void fill(const T *arr, size_t &pos, size_t k) {
+    if (k < blockCount) {
+      for (size_t i = 0; i < B; ++i) {
+        fill(arr, pos, k * (B + 1) + i + 1);
+        blocks[k * B + i] =
+            pos < n ? arr[pos++] : std::numeric_limits<T>::max();
+      }
+      fill(arr, pos, k * (B + 1) + B + 1);
+    }
+  }
+
+  // Number of the keys of the block less than key.
+  static size_t rank(const T *block, const T &key) {
+    size_t res = 0;
+    for (size_t i = 0; i < B; ++i) {
+      res += block[i] < key;
+    }
+    return res;
+  }
+};
+
+#ifdef __AVX2__
+template <>
+inline size_t STree<int32_t>::rank(const int32_t *block, const int32_t &key) {
+  __m256i x = _mm256_set1_epi32(key);
+  __m256i low = _mm256_load_si256(reinterpret_cast<const __m256i *>(block));
+  __m256i high =
+      _mm256_load_si256(reinterpret_cast<const __m256i *>(block + 8));
+  // block[i] < key as key > block[i].
+  unsigned mask = static_cast<unsigned>(
+      _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(x, low))) |
+      _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(x, high)))
+          << 8);
+  return static_cast<size_t>(__builtin_popcount(mask));
+}
+#endif
+
+// Searches which guess where the key lies instead of always bisecting. All
+// of them return the index of the first element not less than key (n if
+// there is none), and add the number of elements they compared with to
+// *probes, as countFind of hw9 counts its compares.
+
+// Plain lower bound on [first, last), the answer being known to lie in
+// [first, last].
+template <typename T>
+size_t _lowerBoundIn(const T *arr, size_t first, size_t last, const T &key,
+                     size_t &probes) {
+  while (first < last) {
+    size_t mid = first + (last - first) / 2;
+    ++probes;
+    if (arr[mid] < key) {
+      first = mid + 1;
+    } else {
+      last = mid;
+    }
+  }
+  return first;
+}
+
+// Galloping search from hint: compare at distances 1, 2, 4, ... from hint
+// towards the key, then bisect the last gap. O(log d) probes, d the distance
+// from hint to the answer, so hint = n - 1 suits keys appended at the tail
+// and the previous answer suits sorted probes.
+template <typename T>
+size_t exponentialSearch(const T *arr, size_t n, const T &key, size_t hint,
+                         size_t *probes = nullptr) {
+  size_t count = 0, res;
+  if (n == 0) {
+    res = 0;
+  } else {
+    if (hint >= n) {
+      hint = n - 1;
+    }
+    ++count;
+    if (arr[hint] < key) {
+      // The answer is in (hint, n].
+      size_t lo = hint, step = 1;
+      while (step < n - lo && (++count, arr[lo + step] < key)) {
+        lo += step;
+        step *= 2;
+      }
+      size_t hi = step < n - lo ? lo + step : n;
+      res = _lowerBoundIn(arr, lo + 1, hi, key, count);
+    } else {
+      // The answer is in [0, hint].
+      size_t hi = hint, step = 1;
+      while (step <= hi && (++count, !(arr[hi - step] < key))) {
+        hi -= step;
+        step *= 2;
+      }
+      size_t lo = step <= hi ? hi - step + 1 : 0;
+      res = _lowerBoundIn(arr, lo, hi, key, count);
+    }
+  }
+  if (probes) *probes += count;
+  return res;
+}
+
+// Where key would lie in [lo, hi] if the values grew linearly from arr[lo]
+// to arr[hi], with arr[lo] < key <= arr[hi].
+template <typename T>
+static inline size_t _interpolate(const T *arr, size_t lo, size_t hi,
+                                  const T &key) {
+  long double frac = (static_cast<long double>(key) - arr[lo]) /
+                     (static_cast<long double>(arr[hi]) - arr[lo]);
+  size_t pos = lo + static_cast<size_t>(frac * (hi - lo));
+  return pos <= lo ? lo + 1 : pos >= hi ? hi - 1 : pos;
+}
+
+// Interpolation search, O(log log n) probes on evenly spread keys. A step
+// which does not at least halve the range is followed by a bisection step,
+// so skewed or adversarial keys cost at most about 2 log2 n probes.
+template <typename T>
+size_t interpolationSearch(const T *arr, size_t n, const T &key,
+                           size_t *probes = nullptr) {
+  static_assert(std::is_arithmetic<T>::value, "interpolation needs numbers");
+  size_t count = 0, res;
+  if (n == 0 || (++count, !(arr[0] < key))) {
+    res = 0;
+  } else if (++count, arr[n - 1] < key) {
+    res = n;
+  } else {
+    // arr[lo] < key <= arr[hi].
+    size_t lo = 0, hi = n - 1;
+    bool bisect = false;
+    while (hi - lo > 1) {
+      size_t range = hi - lo;
+      size_t mid = bisect ? lo + range / 2 : _interpolate(arr, lo, hi, key);
+      ++count;
+      if (arr[mid] < key) {
+        lo = mid;
+      } else {
+        hi = mid;
+      }
+      bisect = !bisect && hi - lo > range / 2;
+    }
+    res = hi;
+  }
+  if (probes) *probes += count;
+  return res;
+}
+
+// Interpolation sequential search: one interpolation over the whole array,
+// then a short scan from there, for keys close to evenly spread. A scan
+// which runs past SEQUENTIAL_LIMIT elements goes on galloping, which bounds
+// the cost by O(log n) on any keys.
+constexpr size_t SEQUENTIAL_LIMIT = 8;
+
+template <typename T>
+size_t interpolationSequentialSearch(const T *arr, size_t n, const T &key,
+                                     size_t *probes = nullptr) {
+  static_assert(std::is_arithmetic<T>::value, "interpolation needs numbers");
+  size_t count = 0, res;
+  if (n == 0 || (++count, !(arr[0] < key))) {
+    res = 0;
+  } else if (++count, arr[n - 1] < key) {
+    res = n;
+  } else {
+    size_t pos = n > 2 ? _interpolate(arr, 0, n - 1, key) : n - 1;
+    size_t steps = 0;
+    ++count;
+    if (arr[pos] < key) {
+      // arr[n - 1] >= key stops the scan.
+      while (steps++ < SEQUENTIAL_LIMIT && (++count, arr[++pos] < key)) {
+      }
+    } else {
+      // arr[0] < key stops the scan.
+      while (steps++ < SEQUENTIAL_LIMIT && (++count, !(arr[pos - 1] < key))) {
+        --pos;
+      }
+    }
+    res = steps <= SEQUENTIAL_LIMIT
+              ? pos
+              : exponentialSearch(arr, n, key, pos, &count);
+  }
+  if (probes) *probes += count;
+  return res;
+}
+
+// Learned index over a sorted array, in the manner of the PGM index.
+// The position of a key is modelled by linear segments, each predicting the
+// position of its keys within epsilon. The segment keys are indexed the same
+// way with epsilonRecursive, level over level, until a single segment is
+// left. A lookup walks down the levels, and at every level searches only the
+// 2 * epsilon + 3 entries around the prediction, so it costs
+// O(levels * log epsilon) compares and the index takes a few bytes for every
+// 2 * epsilon keys. The segments are cut greedily (shrinking cone), which is
+// not the fewest possible but needs one pass.
+// The array is not copied and must outlive the index. A search window which
+// does not bracket the key, as can happen with duplicate keys or keys too
+// large for a double to tell apart, falls back to galloping from the
+// prediction.
+template <typename K>
+class PgmIndex {
+ public:
+  PgmIndex(const K *arr, size_t n, size_t epsilon = 64,
+           size_t epsilonRecursive = 4)
+      : arr(arr), n(n), epsilon(epsilon), epsilonRecursive(epsilonRecursive) {
+    static_assert(std::is_arithmetic<K>::value, "the models need numbers");
+    // The first position of every distinct key.
+    std::vector<K> keys;
+    std::vector<size_t> positions;
+    for (size_t i = 0; i < n; ++i) {
+      if (i == 0 || arr[i - 1] < arr[i]) {
+        keys.push_back(arr[i]);
+        positions.push_back(i);
+      }
+    }
+    while (true) {
+      levels.push_back(
+          fit(keys, positions, levels.empty() ? epsilon : epsilonRecursive));
+      if (levels.back().keys.size() <= 1) {
+        break;
+      }
+      keys = levels.back().keys;
+      positions.resize(keys.size());
+      for (size_t i = 0; i < keys.size(); ++i) {
+        positions[i] = i;
+      }
+    }
+  }
+
+  // Index of the first element not less than key, n if there is none.
+  size_t lowerBound(const K &key) const {
+    size_t seg = 0;
+    for (size_t level = levels.size() - 1; level > 0; --level) {
+      const Level &below = levels[level - 1];
+      size_t pos = search(below.keys.data(), below.keys.size(),
+                          predict(levels[level], seg, key), epsilonRecursive,
+                          key);
+      // The last segment starting at or before key.
+      seg = pos < below.keys.size() && !(key < below.keys[pos]) ? pos
+            : pos > 0                                           ? pos - 1
+                                                                : 0;
+    }
+    if (levels[0].keys.empty()) {
+      return 0;
+    }
+    return search(arr, n, predict(levels[0], seg, key), epsilon, key);
+  }
+
+  bool contains(const K &key) const {
+    size_t pos = lowerBound(key);
+    return pos < n && !(key < arr[pos]);
+  }
+
+  size_t segmentCount() const { return levels[0].keys.size(); }
+
+  size_t levelCount() const { return levels.size(); }
+
+  // Memory taken by the index, the array itself not counted.
+  size_t sizeInBytes() const {
+    size_t res = sizeof(*this);
+    for (const Level &level : levels) {
+      res += level.keys.size() * (sizeof(K) + sizeof(Model));
+    }
+    return res;
+  }
+
+ private:
+  // position ~ intercept + slope * (key - first key of the segment).
+  struct Model {
+    double slope;
+    double intercept;
+  };
+
+  struct Level {
+    std::vector<K> keys;
+    std::vector<Model> models;
+    // The number of positions the models of this level point into.
+    size_t range;
+  };
+
+  const K *arr;
+  size_t n;
+  size_t epsilon, epsilonRecursive;
+  // levels[0] predicts positions in arr, levels[i] the segments of
+  // levels[i - 1], the last level has a single segment.
+  std::vector<Level> levels;
+
+  static Level fit(const std::vector<K> &keys,
+                   const std::vector<size_t> &positions, size_t eps) {
+    Level res;
+    res.range = keys.empty() ? 0 : positions.back() + 1;
+    size_t i = 0;
+    while (i < keys.size()) {
+      // Every slope in [low, high] keeps the points seen so far within eps.
+      K first = keys[i];
+      double y0 = static_cast<double>(positions[i]);
+      double low = 0, high = std::numeric_limits<double>::infinity();
+      size_t j = i + 1;
+      for (; j < keys.size(); ++j) {
+        double dx = static_cast<double>(keys[j]) - static_cast<double>(first);
+        double dy = static_cast<double>(positions[j]) - y0;
+        if (dx <= 0 || dy / dx < low || dy / dx > high) {
+          break;
+        }
+        low = std::max(low, (dy - eps) / dx);
+        high = std::min(high, (dy + eps) / dx);
+      }
+      res.keys.push_back(first);
+      res.models.push_back(
+          {high == std::numeric_limits<double>::infinity() ? 0
+                                                           : (low + high) / 2,
+           y0});
+      i = j;
+    }
+    return res;
+  }
+
+  static size_t predict(const Level &level, size_t seg, const K &key) {
+    const Model &model = level.models[seg];
+    double pos = model.intercept +
+                 model.slope * (static_cast<double>(key) -
+                                static_cast<double>(level.keys[seg]));
+    if (!(pos > 0)) {
+      return 0;
+    }
+    return pos >= static_cast<double>(level.range - 1)
+               ? level.range - 1
+               : static_cast<size_t>(pos);
+  }
+
+  // Lower bound of key in data[0, size), searched around pos.
+  static size_t search(const K *data, size_t size, size_t pos, size_t eps,
+                       const K &key) {
+    size_t first = pos > eps + 1 ? pos - eps - 1 : 0;
+    size_t last = pos + eps + 2 < size ? pos + eps + 2 : size;
+    size_t probes = 0;
+    size_t res = _lowerBoundIn(data, first, last, key, probes);
+    if ((res == first && first > 0 && !(data[first - 1] < key)) ||
+        (res == last && last < size && data[last] < key)) {
+      return exponentialSearch(data, size, key, pos);
+    }
+    return res;
+  }
+};
+
+}  // namespace haomi
+
+#endif
+
+// Test code, 10M random lookups in a sorted array of 100M ints, countFind of
+// hw9/a.cpp and binary_search_with_path of hw9/b.cpp against the searches
+// above. Build with -std=c++20 (countFind takes auto parameters) and
+// -march=native for the AVX2 block search of the S-tree.
+// #include <algorithm>
+// #include <ctime>
+// #include <iostream>
+// #include <memory>
+// #include <vector>
+//
+// size_t countFind(auto &&arr, auto val) {
+//   auto size = arr.size();
+//   size_t left = 0, right = size - 1;
+//   size_t mid = (left + right) / 2;
+//   size_t res{0};
+//   while (left <= right) {
+//     res++;
+//     if (val == arr[mid]) {
+//       return res;
+//     }
+//     if (val < arr[mid]) {
+//       right = mid - 1;
+//       mid = (left + right) / 2;
+//     } else {
+//       left = mid + 1;
+//       mid = (left + right) / 2;
+//     }
+//   }
+//   return SIZE_MAX;
+// }
+//
+// std::vector<int> binary_search_with_path(const std::vector<int> &arr,
+//                                          int key) {
+//   std::vector<int> path;
+//   int left = 0;
+//   int right = static_cast<int>(arr.size()) - 1;
+//   while (left <= right) {
+//     int mid = left + (right - left) / 2;
+//     path.push_back(arr[mid]);
+//     if (arr[mid] == key) {
+//       return path;
+//     } else if (arr[mid] < key) {
+//       left = mid + 1;
+//     } else {
+//       right = mid - 1;
+//     }
+//   }
+//   return {};
+// }
+//
+// template <typename Func>
+// void bench(const char *name, size_t m, Func func) {
+//   clock_t begin = clock();
+//   size_t check = func();
+//   std::cout << name << ": "
+//             << (double)(clock() - begin) * 1e9 / CLOCKS_PER_SEC / m
+//             << " ns/key (" << check << ")\n";
+// }
+//
+// int main() {
+//   const size_t N = 100000000, M = 10000000;
+//   std::vector<int> arr(N), keys(M);
+//   unsigned x = 1;
+//   for (size_t i = 0; i < N; ++i) {
+//     arr[i] = (int)(2 * i);
+//   }
+//   for (int &key : keys) {
+//     x = x * 1103515245 + 12345;
+//     key = (int)(x % (2 * N));
+//   }
+//   std::vector<size_t> index(M);
+//   std::vector<int> value(M);
+//   std::unique_ptr<bool[]> found(new bool[M]);
+//
+//   bench("countFind", M, [&] {
+//     size_t hit = 0;
+//     for (int key : keys) hit += countFind(arr, key) != SIZE_MAX;
+//     return hit;
+//   });
+//   bench("binary_search_with_path", M, [&] {
+//     size_t hit = 0;
+//     for (int key : keys) hit += !binary_search_with_path(arr, key).empty();
+//     return hit;
+//   });
+//   bench("std::lower_bound", M, [&] {
+//     size_t sum = 0;
+//     for (int key : keys) {
+//       sum += std::lower_bound(arr.begin(), arr.end(), key) - arr.begin();
+//     }
+//     return sum;
+//   });
+//   bench("branchless", M, [&] {
+//     size_t sum = 0;
+//     for (int key : keys) {
+//       sum += haomi::branchlessLowerBound(arr.data(), N, key);
+//     }
+//     return sum;
+//   });
+//   bench("branchless batch", M, [&] {
+//     haomi::branchlessLowerBoundBatch(arr.data(), N, keys.data(), M,
+//                                      index.data());
+//     size_t sum = 0;
+//     for (size_t i : index) sum += i;
+//     return sum;
+//   });
+//
+//   clock_t begin = clock();
+//   haomi::EytzingerArray<int> eytzinger(arr.data(), N);
+//   haomi::STree<int> stree(arr.data(), N);
+//   std::cout << "layouts built in "
+//             << (double)(clock() - begin) / CLOCKS_PER_SEC << "s\n";
+//   bench("eytzinger", M, [&] {
+//     size_t hit = 0;
+//     for (int key : keys) hit += eytzinger.contains(key);
+//     return hit;
+//   });
+//   bench("eytzinger batch", M, [&] {
+//     eytzinger.lowerBoundBatch(keys.data(), M, value.data(), found.get());
+//     size_t hit = 0;
+//     for (size_t i = 0; i < M; ++i) hit += found[i] && value[i] == keys[i];
+//     return hit;
+//   });
+//   bench("s-tree", M, [&] {
+//     size_t hit = 0;
+//     for (int key : keys) hit += stree.contains(key);
+//     return hit;
+//   });
+//   bench("s-tree batch", M, [&] {
+//     stree.lowerBoundBatch(keys.data(), M, value.data(), found.get());
+//     size_t hit = 0;
+//     for (size_t i = 0; i < M; ++i) hit += found[i] && value[i] == keys[i];
+//     return hit;
+//   });
+// }
+
+// Test code, average probes and time per lookup of 1M keys in 10M sorted
+// timestamps: evenly spread with jitter, skewed (squares), and lookups of
+// the last 1000 timestamps (the tail of an append only log).
+// #include <ctime>
+// #include <iostream>
+// #include <vector>
+//
+// template <typename Func>
+// void bench(const char *name, const std::vector<int64_t> &keys, Func func) {
+//   size_t probes = 0, sum = 0;
+//   clock_t begin = clock();
+//   for (int64_t key : keys) sum += func(key, &probes);
+//   std::cout << "  " << name << ": " << (double)probes / keys.size()
+//             << " probes, "
+//             << (double)(clock() - begin) * 1e9 / CLOCKS_PER_SEC / keys.size()
+//             << " ns (" << sum << ")\n";
+// }
+//
+// int main() {
+//   const size_t N = 10000000, M = 1000000;
+//   std::vector<int64_t> even(N), skewed(N), keys(M), tail(M);
+//   unsigned x = 1;
+//   for (size_t i = 0; i < N; ++i) {
+//     x = x * 1103515245 + 12345;
+//     even[i] = 1700000000000LL + (int64_t)i * 1000 + (x >> 8) % 1000;
+//     skewed[i] = (int64_t)i * (int64_t)i;
+//   }
+//   for (auto *arr : {&even, &skewed}) {
+//     const int64_t *data = arr->data();
+//     for (size_t i = 0; i < M; ++i) {
+//       x = x * 1103515245 + 12345;
+//       keys[i] = (*arr)[(x >> 4) % N];
+//       tail[i] = (*arr)[N - 1 - (x >> 4) % 1000];
+//     }
+//     for (auto *query : {&keys, &tail}) {
+//       std::cout << (arr == &even ? "even" : "skewed")
+//                 << (query == &keys ? ", random keys" : ", tail keys")
+//                 << ":\n";
+//       bench("bisection", *query, [&](int64_t key, size_t *probes) {
+//         return haomi::_lowerBoundIn(data, 0, N, key, *probes);
+//       });
+//       bench("interpolation", *query, [&](int64_t key, size_t *probes) {
+//         return haomi::interpolationSearch(data, N, key, probes);
+//       });
+//       bench("interpolation sequential", *query,
+//             [&](int64_t key, size_t *probes) {
+//               return haomi::interpolationSequentialSearch(data, N, key,
+//                                                           probes);
+//             });
+//       bench("exponential from the end", *query,
+//             [&](int64_t key, size_t *probes) {
+//               return haomi::exponentialSearch(data, N, key, N - 1, probes);
+//             });
+//     }
+//   }
+// }
+
+// Test code, size and time per lookup of the learned index against the
+// branchless search and a B-tree over 20M sorted timestamps, evenly spread
+// with jitter and bursty (gaps drawn from a long tailed distribution). The
+// B-tree is the S-tree above, which keeps every key in its 64 byte blocks, so
+// the index part of it is taken to be its inner blocks.
+// On even data one segment of 80 bytes covers all the keys and the learned
+// index is the fastest, 110 to 200 ns against 270 ns for the B-tree, whose
+// inner blocks take 17.8 MB, and 520 ns for the branchless search. On bursty
+// data it needs 11 KB to 2 MB and takes 380 to 490 ns, slower than the
+// B-tree (300 ns) but still ahead of the branchless search (620 ns).
+// #include <chrono>
+// #include <iostream>
+// #include <vector>
+//
+// template <typename Func>
+// double nsPerOp(const std::vector<int64_t> &keys, Func func) {
+//   size_t sum = 0;
+//   auto begin = std::chrono::steady_clock::now();
+//   for (int64_t key : keys) sum += func(key);
+//   std::chrono::duration<double, std::nano> time =
+//       std::chrono::steady_clock::now() - begin;
+//   if (sum == 42) std::cout << "";
+//   return time.count() / keys.size();
+// }
+//
+// int main() {
+//   const size_t N = 20000000, M = 2000000;
+//   std::vector<int64_t> even(N), bursty(N), keys(M);
+//   unsigned x = 1;
+//   for (size_t i = 0; i < N; ++i) {
+//     x = x * 1103515245 + 12345;
+//     even[i] = 1700000000000LL + (int64_t)i * 1000 + (x >> 8) % 1000;
+//     unsigned gap = (x >> 8) % 1024;
+//     bursty[i] = (i ? bursty[i - 1] : 0) + 1 +
+//                 (int64_t)gap * gap * gap / 1000;
+//   }
+//   for (auto *arr : {&even, &bursty}) {
+//     const int64_t *data = arr->data();
+//     for (size_t i = 0; i < M; ++i) {
+//       x = x * 1103515245 + 12345;
+//       keys[i] = (*arr)[(x >> 4) % N] + (x & 1);
+//     }
+//     const size_t B = haomi::STree<int64_t>::B;
+//     size_t blocks = (N + B - 1) / B;
+//     size_t inner = (blocks - 1 + B) / (B + 1);
+//     haomi::STree<int64_t> tree(data, N);
+//     std::cout << (arr == &even ? "even" : "bursty") << ":\n"
+//               << "  branchless: "
+//               << nsPerOp(keys, [&](int64_t key) {
+//                    return haomi::branchlessLowerBound(data, N, key);
+//                  })
+//               << " ns\n  B-tree: " << inner * 64 << " bytes inner, "
+//               << blocks * 64 << " bytes in all, "
+//               << nsPerOp(keys, [&](int64_t key) {
+//                    int64_t res = 0;
+//                    tree.lowerBound(key, res);
+//                    return (size_t)res;
+//                  })
+//               << " ns\n";
+//     for (size_t eps : {16, 64, 256}) {
+//       haomi::PgmIndex<int64_t> index(data, N, eps);
+//       std::cout << "  learned, epsilon " << eps << ": "
+//                 << index.segmentCount() << " segments, "
+//                 << index.levelCount() << " levels, "
+//                 << index.sizeInBytes() << " bytes, "
+//                 << nsPerOp(keys, [&](int64_t key) {
+//                      return index.lowerBound(key);
+//                    })
+//                 << " ns\n";
+//     }
+//   }
+// }